@@ -1,116 +1,399 @@
 #include "state.h"
 #include "adc.h"
+#include "load.h"
+#include "events.h"
+#include "perf.h"
+#include "calibration.h"
+#include "protection.h"
 
-#define SAMPLES 16
+static inline void adc_setscanchannels(int last);
+static inline uint16_t adc_readresult(int which);
+static inline void adc_startscan(void);
+
+#if ADC_AVERAGE == ADC_AVERAGE_BLOCK
+// up to 4^ADC_MAXOVERSAMPLING conversions go into a sum
+typedef uint32_t adcsum;
+#else
+typedef uint16_t adcsum;
+#endif
 
 typedef struct {
 	int channel;
 	uint16_t* samples;
+	adcsum sum;
+	adcsum total;
 } channelsamples;
 
+#if ADC_AVERAGE == ADC_AVERAGE_MOVING
 static uint16_t voltsamples[SAMPLES] = { 0 };
-static uint16_t volthighgainsamples[SAMPLES] = { 0 };
 static uint16_t shuntsamples[SAMPLES] = { 0 };
+#define SAMPLEBUFFER(buffer) (buffer)
+#else
+// block averages are summed up as they come in
+#define SAMPLEBUFFER(buffer) (0)
+#endif
 
+// only the voltage channel for the range that's in use is averaged,
+// the first entry switches between ADC_VIN and ADC_VIN_HIGHGAIN
 static channelsamples channels[] = { //
-		{ .channel = ADC_VIN, .samples = voltsamples }, //
-				{ .channel = ADC_VIN_HIGHGAIN, .samples = volthighgainsamples }, //
-				{ .channel = ADC_SHUNT, .samples = shuntsamples } //
+		{ .channel = ADC_VIN, .samples = SAMPLEBUFFER(voltsamples) }, //
+				{ .channel = ADC_SHUNT, .samples = SAMPLEBUFFER(shuntsamples) } //
 		};
 
-static bool conversionfinished = false;
+#define NUMCHANNELS (sizeof(channels) / sizeof(channels[0]))
+#define VOLTCHANNEL (&channels[0])
+#define SHUNTCHANNEL (&channels[1])
+
+#ifdef ADC_TRACE
+// the simulator has no adc, so a recording of raw readings of vin, vin
+// high gain and the shunt is played back instead
+#include ADC_TRACE
+
+#define TRACELENGTH (sizeof(adctrace) / sizeof(adctrace[0]))
+
+static uint16_t tracepos = 0;
+static bool traceplayed = false;
+#endif
+
+static volatile bool conversionfinished = false;
+
+// what the last readings were computed from, kept for calibration
+static uint16_t lastshuntraw, lastvoltraw;
+static bool lasthighgain;
+static uint16_t sample = 0;
+
+// the range the isr is converting, the one adc_computereadings wants and
+// the one the totals came from
+static bool highgainrange = false;
+static volatile bool wanthighgain = false;
+static bool totalhighgain = false;
+
+// the last normal voltage conversion from a high gain scan
+static uint8_t rangescans = 0;
+static uint16_t rangecheckraw;
+static bool rangecheckfresh = false;
+
+#if ADC_AVERAGE == ADC_AVERAGE_MOVING
+// conversions left until the voltage samples are all from the new range
+static uint8_t settling = 0;
+#endif
+
+#if ADC_AVERAGE == ADC_AVERAGE_BLOCK
+// the totals are 4^oversampling conversions
+static uint8_t oversampling = ADC_OVERSAMPLING;
+static uint16_t blocksamples = 1 << (ADC_OVERSAMPLING * 2);
+// what the totals were summed up with
+static uint8_t totalshift;
+#else
+#define blocksamples SAMPLES
+#endif
 
 static inline void adc_clearint() {
 	ADC_CSR &= ~ADC_CSR_EOC;
 }
 
+#ifdef ADC_TRACE
+static uint16_t adc_traceresult(int channel) {
+	switch (channel) {
+	case ADC_VIN:
+		return adctrace[tracepos][0];
+	case ADC_VIN_HIGHGAIN:
+		return adctrace[tracepos][1];
+	default:
+		return adctrace[tracepos][2];
+	}
+}
+#endif
+
+static inline uint16_t adc_result(int channel) {
+#ifdef ADC_TRACE
+	return adc_traceresult(channel);
+#else
+	return adc_readresult(channel);
+#endif
+}
+
+// only done between scans, the scan always starts at AIN0 so it has to
+// run up to whichever voltage channel is in use
+static void adc_switchrange(void) {
+#if ADC_AVERAGE == ADC_AVERAGE_MOVING
+	uint8_t i;
+#endif
+
+	highgainrange = wanthighgain;
+	rangescans = 0;
+	rangecheckfresh = false;
+	VOLTCHANNEL->channel = highgainrange ? ADC_VIN_HIGHGAIN : ADC_VIN;
+	adc_setscanchannels(VOLTCHANNEL->channel);
+	VOLTCHANNEL->sum = 0;
+#if ADC_AVERAGE == ADC_AVERAGE_MOVING
+	for (i = 0; i < SAMPLES; i++)
+		VOLTCHANNEL->samples[i] = 0;
+	settling = SAMPLES - 1;
+#endif
+}
+
 static inline void adc_interrupthandler_body(void) {
-	static uint8_t channel = 0;
-	static uint8_t sample = 0;
-
-	channels[channel].samples[sample] = adc_readresult();
-	channel++;
-	if (channel == 3) {
-		channel = 0;
-		sample++;
-		if (sample == SAMPLES) {
-			sample = 0;
-			adc_clearint();
-			conversionfinished = true;
-		}
+	uint8_t i;
+	channelsamples* cs;
+	uint16_t result;
+	uint16_t voltresult = 0;
+
+#ifndef ADC_TRACE
+	// the analog watchdog goes off as soon as the shunt conversion that
+	// tripped it is done, that can be in the middle of a scan
+	if (ADC_CSR & ADC_CSR_AWD) {
+		protection_onwatchdog(adc_readresult(ADC_SHUNT));
+		ADC_AWSRL = 0;
+		ADC_AWSRH = 0;
+		ADC_CSR &= ~ADC_CSR_AWD;
+	}
+	if (!(ADC_CSR & ADC_CSR_EOC))
+		return;
+#endif
+
+	adc_clearint();
+
+	for (i = 0; i < NUMCHANNELS; i++) {
+		cs = &channels[i];
+		result = adc_result(cs->channel);
+#if ADC_AVERAGE == ADC_AVERAGE_MOVING
+		cs->sum -= cs->samples[sample];
+		cs->samples[sample] = result;
+#endif
+		cs->sum += result;
+		if (cs == VOLTCHANNEL)
+			voltresult = result;
+	}
+	protection_checkscan(voltresult, highgainrange);
+
+	if (highgainrange && ++rangescans >= ADC_RANGECHECKSCANS) {
+		rangescans = 0;
+		rangecheckraw = adc_result(ADC_VIN);
+		rangecheckfresh = true;
 	}
 
-	if (!conversionfinished)
-		adc_triggerconversion(channels[channel].channel);
+	sample++;
+	if (sample >= blocksamples)
+		sample = 0;
+
+#ifdef ADC_TRACE
+	tracepos++;
+	if (tracepos == TRACELENGTH) {
+		tracepos = 0;
+		traceplayed = true;
+	}
+#endif
+
+#if ADC_AVERAGE == ADC_AVERAGE_BLOCK
+	if (sample != 0) {
+#if ADC_TRIGGER == ADC_TRIGGER_SOFTWARE && !defined(ADC_TRACE)
+		adc_startscan();
+#endif
+		return;
+	}
+#else
+	if (settling != 0) {
+		settling--;
+#if ADC_TRIGGER == ADC_TRIGGER_SOFTWARE && !defined(ADC_TRACE)
+		adc_startscan();
+#endif
+		return;
+	}
+#endif
+
+	for (i = 0; i < NUMCHANNELS; i++) {
+		cs = &channels[i];
+		cs->total = cs->sum;
+#if ADC_AVERAGE == ADC_AVERAGE_BLOCK
+		cs->sum = 0;
+#endif
+	}
+#if ADC_AVERAGE == ADC_AVERAGE_BLOCK
+	totalshift = oversampling * 2;
+#endif
+	totalhighgain = highgainrange;
+	if (wanthighgain != highgainrange)
+		adc_switchrange();
+	conversionfinished = true;
+	events_post(EVENT_ADC);
 }
 
 void adc_interrupthandler(void)
 __interrupt( INTERRUPT_ADC1) {
+	perf_enter(PERF_ADCISR);
 	adc_interrupthandler_body();
+	perf_exit(PERF_ADCISR);
 }
 
-static inline void adc_setchan(int which) {
+static inline void adc_setscanchannels(int last) {
 	uint8_t csr = ADC_CSR;
-	csr &= ~(0b111 | ADC_CSR_EOC);
-	csr |= which;
+	csr &= ~(0b1111 | ADC_CSR_EOC);
+	csr |= last;
 	ADC_CSR = csr;
 }
 
-static inline void adc_triggerconversion(int channel) {
-	adc_setchan(channel);
+static inline void adc_startscan(void) {
+#ifdef ADC_TRACE
+	// run the isr body for a whole round right here, it's called from the
+	// main loop so keep the isrs out of the way while it posts its event
+	__critical {
+		do
+			adc_interrupthandler_body();
+		while (!conversionfinished);
+	}
+#else
 	ADC_CR1 |= ADC_CR1_ADON;
+#endif
 }
 
-static inline uint16_t adc_readresult() {
-	uint16_t result = (((uint16_t) ADC_DRH) << 2) | ADC_DRL;
+static inline uint16_t adc_readresult(int which) {
+	uint16_t result = (((uint16_t) ADC_DBRH(which)) << 2) | ADC_DBRL(which);
 	return result;
 }
 
-static inline void adc_startconversion(void) {
-	adc_triggerconversion(channels[0].channel);
-}
-
 void adc_init(void) {
-	adc_setchan(ADC_VIN);
+	adc_setscanchannels(VOLTCHANNEL->channel);
+	ADC_CR2 |= ADC_CR2_SCAN;
 	ADC_CSR |= ADC_CSR_EOCIE;
 	ADC_CR1 |= ADC_CR1_ADON;
-	adc_startconversion();
+#if ADC_TRIGGER == ADC_TRIGGER_PWM
+	// TIM1 TRGO is EXTSEL 0
+	ADC_CR2 |= ADC_CR2_EXTTRIG;
+	load_enableadctrigger(ADC_PWMPERIODSPERSCAN);
+#else
+	adc_startscan();
+#endif
 }
 
-bool adc_updatereadings(void) {
-	unsigned i;
-	uint32_t voltsum = 0;
-	uint32_t shuntsum = 0;
-	uint32_t volthighgainsum = 0;
+// the sums are 2^shift conversions, turns them into counts with
+// CALIBRATION_RAWSHIFT fractional bits
+static inline uint16_t adc_raw(uint32_t sum, uint8_t shift) {
+	return (uint16_t) ((sum << CALIBRATION_RAWSHIFT) >> shift);
+}
+
+static void adc_computereadings(uint16_t shuntraw, uint16_t voltraw,
+		bool fromhighgain) {
 	uint32_t wattstemp = 0;
-	uint16_t lowgainvolts, highgainvolts;
+
+	amps = calibration_apply(CALIBRATION_SHUNT, shuntraw);
+	highgain = fromhighgain;
+	volts = calibration_apply(
+			highgain ? CALIBRATION_VINHIGHGAIN : CALIBRATION_VIN, voltraw);
+
+	// the high gain amplifier saturates not far above ADC_RANGEUP and
+	// what it reads past that can't be trusted, the normal channel is
+	// checked as well in adc_updatereadings
+	if (highgain && volts > ADC_RANGEUP)
+		wanthighgain = false;
+	else if (!highgain && volts < ADC_RANGEDOWN)
+		wanthighgain = true;
+
+	wattstemp = ((uint32_t) amps * (uint32_t) volts) / 1000;
+	watts = (uint16_t) wattstemp;
+}
+
+#ifdef ADC_TRACE
+// true once every time the whole recording has been played back
+bool adc_traceplayed(void) {
+	bool played = traceplayed;
+	traceplayed = false;
+	return played;
+}
+#endif
+
+#if ADC_AVERAGE == ADC_AVERAGE_BLOCK
+// 4^n conversions per reading, n of 0 gives a reading per scan
+bool adc_setoversampling(uint8_t n) {
+	if (n > ADC_MAXOVERSAMPLING)
+		return false;
+
+	// the block being summed up now is started over with the new size
+	disableInterrupts();
+	oversampling = n;
+	blocksamples = 1 << (n * 2);
+	VOLTCHANNEL->sum = 0;
+	SHUNTCHANNEL->sum = 0;
+	sample = 0;
+	enableInterrupts();
+	return true;
+}
+
+uint8_t adc_getoversampling(void) {
+	return oversampling;
+}
+#else
+bool adc_setoversampling(uint8_t n) {
+	(void) n;
+	return false;
+}
+
+uint8_t adc_getoversampling(void) {
+	return 0;
+}
+#endif
+
+// the raw reading behind the last update for a channel, only the voltage
+// channel for the range in use has one
+bool adc_getraw(calibration_index which, uint16_t* raw) {
+	switch (which) {
+	case CALIBRATION_SHUNT:
+		*raw = lastshuntraw;
+		return true;
+	case CALIBRATION_VIN:
+		*raw = lastvoltraw;
+		return !lasthighgain;
+	case CALIBRATION_VINHIGHGAIN:
+		*raw = lastvoltraw;
+		return lasthighgain;
+	default:
+		return false;
+	}
+}
+
+bool adc_updatereadings(void) {
+	adcsum voltsum, shuntsum;
+	bool fromhighgain;
+	uint8_t shift;
+	uint16_t checkraw;
+	bool checkfresh;
 
 	if (conversionfinished) {
-		// trigger the next round
+		perf_enter(PERF_ADCUPDATE);
+		// with the pwm trigger the isr keeps running so take a consistent
+		// copy of the totals
+		disableInterrupts();
+		voltsum = VOLTCHANNEL->total;
+		shuntsum = SHUNTCHANNEL->total;
+		fromhighgain = totalhighgain;
+		checkraw = rangecheckraw;
+		checkfresh = rangecheckfresh;
+		rangecheckfresh = false;
+#if ADC_AVERAGE == ADC_AVERAGE_BLOCK
+		shift = totalshift;
+#else
+		shift = ADC_SAMPLESHIFT;
+#endif
 		conversionfinished = false;
-		adc_startconversion();
-
-		for (i = 0; i < SAMPLES; i++) {
-			shuntsum += shuntsamples[i];
-			voltsum += voltsamples[i];
-			volthighgainsum += volthighgainsamples[i];
-		}
-
-		amps = ((shuntsum / SAMPLES) * MICROVOLTSPERSTEP_SHUNT) / 20;
-		highgainvolts = (((volthighgainsum / SAMPLES)
-				* MILLIVOLTSPERSTEP_HIGHGAIN) / 10) - HIGHOFFSET;
-		lowgainvolts = (voltsum / SAMPLES) * (MILLIVOLTSPERSTEP);
-		highgain = lowgainvolts <= 6000;
-		if (highgain)
-			volts = highgainvolts;
-		else
-			volts = lowgainvolts;
-
-		wattstemp = ((uint32_t) amps * (uint32_t) volts) / 1000;
-		watts = (uint16_t) wattstemp;
+		enableInterrupts();
 
+#if ADC_TRIGGER == ADC_TRIGGER_SOFTWARE
+		// trigger the next round
+		adc_startscan();
+#endif
+
+		lastshuntraw = adc_raw(shuntsum, shift);
+		lastvoltraw = adc_raw(voltsum, shift);
+		lasthighgain = fromhighgain;
+		adc_computereadings(lastshuntraw, lastvoltraw, fromhighgain);
+		// a single conversion is plenty to see the high gain range is
+		// past its top with ADC_RANGEUP - ADC_RANGEDOWN of hysteresis
+		if (checkfresh && fromhighgain
+				&& calibration_apply(CALIBRATION_VIN,
+						adc_raw(checkraw, 0)) > ADC_RANGEUP)
+			wanthighgain = false;
+		perf_exit(PERF_ADCUPDATE);
 		return true;
 	} else
 		return false;
-
 }
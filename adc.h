@@ -3,11 +3,13 @@
 #include <stdbool.h>
 
 #include "stm8.h"
+#include "calibration.h"
 
 #define ADC_VIN 4
 #define ADC_SHUNT 3
 #define ADC_VIN_HIGHGAIN 5
 
+// defaults for units that haven't been calibrated
 #define MILLIVOLTSPERSTEP 20
 
 // tenths of millivolts
@@ -16,13 +18,88 @@
 
 #define MICROVOLTSPERSTEP_SHUNT 68
 
+// how the samples are averaged, moving keeps a running sum per channel
+// and has a fresh average after every set of conversions, block
+// oversamples, it waits for 4^n new conversions of each channel and keeps
+// the extra n bits all the way through to the readings. n can be changed
+// at runtime to trade update rate for resolution
+#define ADC_AVERAGE_MOVING 0
+#define ADC_AVERAGE_BLOCK 1
+
+#ifndef ADC_AVERAGE
+#define ADC_AVERAGE ADC_AVERAGE_MOVING
+#endif
+
+// mV, below RANGEDOWN the high gain channel is used and above RANGEUP
+// the normal one. the high gain one clips at about 6.6V
+#ifndef ADC_RANGEDOWN
+#define ADC_RANGEDOWN 5700
+#endif
+
+#ifndef ADC_RANGEUP
+#define ADC_RANGEUP 6300
+#endif
+
+// the high gain scan converts the normal voltage channel on the way, one
+// in this many scans it's looked at to see if the high gain amplifier has
+// run out of headroom
+#ifndef ADC_RANGECHECKSCANS
+#define ADC_RANGECHECKSCANS 16
+#endif
+
+// what starts a scan, software starts the next one as soon as the last
+// readings have been picked up, pwm has TIM1 start one at the beginning
+// of every ADC_PWMPERIODSPERSCANth pwm period so the samples are always
+// taken at the same point of the load ripple
+#define ADC_TRIGGER_SOFTWARE 0
+#define ADC_TRIGGER_PWM 1
+
+#ifndef ADC_TRIGGER
+#define ADC_TRIGGER ADC_TRIGGER_SOFTWARE
+#endif
+
+// 64us pwm periods, has to fit TIM1_RCR
+#ifndef ADC_PWMPERIODSPERSCAN
+#define ADC_PWMPERIODSPERSCAN 8
+#endif
+
+#if defined(ADC_TRACE) && ADC_TRIGGER != ADC_TRIGGER_SOFTWARE
+#error "trace playback needs ADC_TRIGGER_SOFTWARE"
+#endif
+
+// samples per channel in a moving average are 2^ADC_SAMPLESHIFT, the
+// sums are 16 bits wide so this can be at most 6
+#ifndef ADC_SAMPLESHIFT
+#define ADC_SAMPLESHIFT 4
+#endif
+
+#define SAMPLES (1 << ADC_SAMPLESHIFT)
+
+// block averages are 4^n samples, 4 gives 14 bits
+#define ADC_MAXOVERSAMPLING 4
+
+#ifndef ADC_OVERSAMPLING
+#define ADC_OVERSAMPLING 2
+#endif
+
+// readings to throw away after a change to the load before one is made up
+// only of samples taken after it, the scan in flight always has some of
+// before in it
+#if ADC_AVERAGE == ADC_AVERAGE_BLOCK
+#define ADC_STALEREADINGS 1
+#else
+#define ADC_STALEREADINGS SAMPLES
+#endif
+
 void adc_interrupthandler(void)
 __interrupt( INTERRUPT_ADC1);
 
 uint16_t readadc(int which);
 bool adc_updatereadings(void);
+bool adc_setoversampling(uint8_t n);
+uint8_t adc_getoversampling(void);
+bool adc_getraw(calibration_index which, uint16_t* raw);
 void adc_init(void);
-
-static inline void adc_setchan(int which);
-static inline uint16_t adc_readresult(void);
-static inline void adc_triggerconversion(int channel);
+#ifdef ADC_TRACE
+bool adc_traceplayed(void);
+#endif
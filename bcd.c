@@ -0,0 +1,57 @@
+#include <stdbool.h>
+
+#include "bcd.h"
+#include "perf.h"
+
+#define MAXDIGITS 5
+
+static const uint16_t powers[MAXDIGITS] = { 10000, 1000, 100, 10, 1 };
+
+// each digit is counted out by subtracting its power of ten
+static uint8_t bcd_convert(uint16_t value, uint8_t* digits, uint8_t n,
+		bool suppress) {
+	uint8_t i, d;
+	uint8_t written = 0;
+	uint16_t power;
+
+	perf_enter(PERF_SPLIT);
+	for (; n > MAXDIGITS; n--) {
+		if (!suppress) {
+			*digits++ = 0;
+			written++;
+		}
+	}
+
+	for (i = 0; i < MAXDIGITS; i++) {
+		power = powers[i];
+		d = 0;
+		while (value >= power) {
+			value -= power;
+			d++;
+		}
+		if (i < MAXDIGITS - n)
+			continue;
+		if (suppress && d == 0 && written == 0 && i != MAXDIGITS - 1)
+			continue;
+		*digits++ = d;
+		written++;
+	}
+	perf_exit(PERF_SPLIT);
+	return written;
+}
+
+void bcd_split(uint16_t value, uint8_t* digits, uint8_t n) {
+	bcd_convert(value, digits, n, false);
+}
+
+uint8_t bcd_splitsuppressed(uint16_t value, uint8_t* digits, uint8_t n) {
+	return bcd_convert(value, digits, n, true);
+}
+
+// times ten is done as x * 8 + x * 2
+uint16_t bcd_pack(uint8_t* digits, uint8_t n) {
+	uint16_t value = 0;
+	for (; n > 0; n--)
+		value = (value << 3) + (value << 1) + *digits++;
+	return value;
+}
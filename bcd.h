@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+// decimal conversion without division, digits come out most significant
+// first as plain values 0 - 9
+
+// always n digits, values that don't fit lose their top digits
+void bcd_split(uint16_t value, uint8_t* digits, uint8_t n);
+// like bcd_split but leading zeros are left out, returns how many digits
+// were written which is at least one
+uint8_t bcd_splitsuppressed(uint16_t value, uint8_t* digits, uint8_t n);
+uint16_t bcd_pack(uint8_t* digits, uint8_t n);
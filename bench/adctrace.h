@@ -0,0 +1,73 @@
+#pragma once
+
+// synthetic recording for the simulator benchmark, adc counts per scan for
+// vin, vin high gain and the shunt.
+// 12V at 1A for the first half, then 5V at 500mA so the high gain range
+// gets used too
+
+static const uint16_t adctrace[][3] = { //
+		{ 600, 1023, 294 }, //
+		{ 601, 1023, 295 }, //
+		{ 602, 1023, 296 }, //
+		{ 601, 1023, 295 }, //
+		{ 600, 1023, 294 }, //
+		{ 599, 1023, 293 }, //
+		{ 598, 1023, 292 }, //
+		{ 599, 1023, 293 }, //
+		{ 600, 1023, 294 }, //
+		{ 601, 1023, 295 }, //
+		{ 602, 1023, 296 }, //
+		{ 601, 1023, 295 }, //
+		{ 600, 1023, 294 }, //
+		{ 599, 1023, 293 }, //
+		{ 598, 1023, 292 }, //
+		{ 599, 1023, 293 }, //
+		{ 600, 1023, 294 }, //
+		{ 601, 1023, 295 }, //
+		{ 602, 1023, 296 }, //
+		{ 601, 1023, 295 }, //
+		{ 600, 1023, 294 }, //
+		{ 599, 1023, 293 }, //
+		{ 598, 1023, 292 }, //
+		{ 599, 1023, 293 }, //
+		{ 600, 1023, 294 }, //
+		{ 601, 1023, 295 }, //
+		{ 602, 1023, 296 }, //
+		{ 601, 1023, 295 }, //
+		{ 600, 1023, 294 }, //
+		{ 599, 1023, 293 }, //
+		{ 598, 1023, 292 }, //
+		{ 599, 1023, 293 }, //
+		{ 250, 772, 147 }, //
+		{ 251, 773, 148 }, //
+		{ 252, 774, 149 }, //
+		{ 251, 773, 148 }, //
+		{ 250, 772, 147 }, //
+		{ 249, 771, 146 }, //
+		{ 248, 770, 145 }, //
+		{ 249, 771, 146 }, //
+		{ 250, 772, 147 }, //
+		{ 251, 773, 148 }, //
+		{ 252, 774, 149 }, //
+		{ 251, 773, 148 }, //
+		{ 250, 772, 147 }, //
+		{ 249, 771, 146 }, //
+		{ 248, 770, 145 }, //
+		{ 249, 771, 146 }, //
+		{ 250, 772, 147 }, //
+		{ 251, 773, 148 }, //
+		{ 252, 774, 149 }, //
+		{ 251, 773, 148 }, //
+		{ 250, 772, 147 }, //
+		{ 249, 771, 146 }, //
+		{ 248, 770, 145 }, //
+		{ 249, 771, 146 }, //
+		{ 250, 772, 147 }, //
+		{ 251, 773, 148 }, //
+		{ 252, 774, 149 }, //
+		{ 251, 773, 148 }, //
+		{ 250, 772, 147 }, //
+		{ 249, 771, 146 }, //
+		{ 248, 770, 145 }, //
+		{ 249, 771, 146 } //
+		};
@@ -0,0 +1,29 @@
+# compares the last PERF report in each file, lines look like
+# name,calls,min,max,total. anything else the firmware sent is skipped.
+
+NF == 5 && $1 ~ /^[A-Z]+$/ {
+	if (FILENAME == ARGV[1]) {
+		baseline[$1] = $4
+		entries++
+	} else
+		current[$1] = $4
+}
+
+END {
+	failed = 0
+	# a baseline with nothing in it would pass anything
+	if (entries == 0) {
+		printf "%s: no baseline, make benchbaseline first\n", ARGV[1]
+		exit 1
+	}
+	for (name in baseline) {
+		if (!(name in current)) {
+			printf "%s: missing\n", name
+			failed = 1
+		} else if (current[name] * 100 > baseline[name] * (100 + slack)) {
+			printf "%s: max %d cycles, was %d\n", name, current[name], baseline[name]
+			failed = 1
+		}
+	}
+	exit failed
+}
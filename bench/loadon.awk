@@ -0,0 +1,21 @@
+# bench.in turns the load on, the unit has to keep streaming state lines
+# with it on and must not have been reset by the watchdog along the way
+
+{
+	booted += gsub(/BOOTED/, "")
+	if ($0 ~ /^on,/)
+		onlines++
+}
+
+END {
+	failed = 0
+	if (booted != 1) {
+		printf "booted %d times\n", booted
+		failed = 1
+	}
+	if (onlines == 0) {
+		printf "no state lines with the load on\n"
+		failed = 1
+	}
+	exit failed
+}
@@ -1,26 +1,29 @@
 #include "buttons.h"
 #include "state.h"
 #include "util.h"
+#include "bcd.h"
+#include "events.h"
+#include "timer.h"
 
-static uint16_t setdown = 0;
-static uint16_t ondown = 0;
+// ms a press has to be held for
+#define LONGPRESS 2000
+#define SHORTPRESS 100
+
+static uint32_t setdown = 0;
+static uint32_t ondown = 0;
 static volatile presstype setpt = PT_NONE;
 static volatile presstype onpt = PT_NONE;
 
-static inline uint16_t buttons_gettime() {
-	return ((TIM2_CNTRH << 8) | (TIM2_CNTRL)) & 0x7fff;
+static inline uint32_t buttons_gettime() {
+	return timer_millis();
 }
 
-static inline presstype buttons_getpresstype(uint16_t downtime) {
-	uint16_t now = buttons_gettime();
-	uint16_t timedown;
-	if (now < downtime)
-		downtime |= 1 << 15;
+static inline presstype buttons_getpresstype(uint32_t downtime) {
+	uint32_t timedown = buttons_gettime() - downtime;
 
-	timedown = now - downtime;
-	if (timedown > 1000)
+	if (timedown > LONGPRESS)
 		return PT_LONG;
-	else if (timedown > 50)
+	else if (timedown > SHORTPRESS)
 		return PT_SHORT;
 	else
 		return PT_NONE;
@@ -31,6 +34,7 @@ __interrupt( INTERRUPT_TLI) {
 	if(setpt == PT_NONE) {
 		setpt = PT_DOWN;
 		setdown = buttons_gettime();
+		events_post(EVENT_BUTTONS);
 	}
 }
 
@@ -39,6 +43,7 @@ __interrupt(INTERRUPT_EXTI3) {
 	if(onpt == PT_NONE) {
 		onpt = PT_DOWN;
 		ondown = buttons_gettime();
+		events_post(EVENT_BUTTONS);
 	}
 }
 
@@ -49,14 +54,39 @@ static void buttons_incdisplaymode(void) {
 }
 
 static void buttons_incselecteddigit(void) {
-	digitbeingset = (digitbeingset + 1) % 3;
+	digitbeingset = (digitbeingset + 1) % 4;
 }
 
+// the last digit is the unit, stepping it changes the regulation mode.
+// the other three are the ones on the display, which leaves out the top
+// one of the five when it's 0 the same way display_update does
 static void buttons_incvalue() {
-	uint16_t tmp[4];
-	split(targetamps, tmp, 4);
-	tmp[digitbeingset] = (tmp[digitbeingset] + 1) % 10;
-	targetamps = pack(tmp, 4);
+	uint8_t tmp[5];
+	uint16_t* setpoint;
+	uint8_t digit, i;
+	uint32_t value = 0;
+
+	if (digitbeingset == 3) {
+		rm++;
+		if (rm == REGMODE_END)
+			rm = 0;
+		return;
+	}
+
+	setpoint = state_setpoint();
+	bcd_split(*setpoint, tmp, 5);
+	digit = digitbeingset + (tmp[0] == 0 ? 1 : 0);
+	if (tmp[digit] == 9)
+		tmp[digit] = 0;
+	else
+		tmp[digit]++;
+
+	// the digit goes back round to 0 where it would go past 65535
+	for (i = 0; i < 5; i++)
+		value = (value * 10) + tmp[i];
+	if (value > 0xffff)
+		tmp[digit] = 0;
+	*setpoint = bcd_pack(tmp, 5);
 }
 
 bool buttons_check(void) {
@@ -70,9 +100,13 @@ bool buttons_check(void) {
 		onpt = buttons_getpresstype(ondown);
 		switch (om) {
 		case OPMODE_OFF:
-			om = OPMODE_ON;
+			if (onpt == PT_LONG)
+				om = OPMODE_TRANSIENT;
+			else
+				om = OPMODE_ON;
 			break;
 		case OPMODE_ON:
+		case OPMODE_TRANSIENT:
 			om = OPMODE_OFF;
 			break;
 		case OPMODE_SET:
@@ -81,6 +115,11 @@ bool buttons_check(void) {
 			else
 				buttons_incvalue();
 			break;
+		case OPMODE_LVC:
+		case OPMODE_OCP:
+		case OPMODE_OPP:
+			// a trip is cleared from set
+			break;
 		}
 		onpt = PT_NONE;
 	}
@@ -89,6 +128,7 @@ bool buttons_check(void) {
 		setpt = buttons_getpresstype(setdown);
 		switch (om) {
 		case OPMODE_ON:
+		case OPMODE_TRANSIENT:
 			buttons_incdisplaymode();
 			break;
 		case OPMODE_OFF:
@@ -105,6 +145,8 @@ bool buttons_check(void) {
 				buttons_incdisplaymode();
 			break;
 		case OPMODE_LVC:
+		case OPMODE_OCP:
+		case OPMODE_OPP:
 			if (setpt == PT_LONG)
 				om = OPMODE_OFF;
 			break;
@@ -118,9 +160,6 @@ bool buttons_check(void) {
 void buttons_init(void) {
 	const uint8_t mask = (1 << 3) | (1 << 7);
 
-	TIM2_PSCR |= 0x0f;
-	TIM2_CR1 |= TIM2_CR1_CEN;
-
 	EXTI_CR1 |= EXTI_CR1_PDIS_FALLING;
 
 	*PD_DDR &= ~mask; // input
@@ -0,0 +1,172 @@
+#include "calibration.h"
+#include "adc.h"
+#include "eeprom.h"
+#include "util.h"
+
+#define GAINMIN 0x2000
+#define GAINMAX 0x4000
+
+// the build time constants, per raw count scaled by 2^6
+static const calibration_channel defaults[CALIBRATION_END] = { //
+		[CALIBRATION_VIN] = { .gain = MILLIVOLTSPERSTEP << 9, .shift = 15 }, //
+				[CALIBRATION_VINHIGHGAIN] = { .gain =
+						(MILLIVOLTSPERSTEP_HIGHGAIN << 11) / 10, .shift = 17,
+						.offset = -HIGHOFFSET }, //
+				[CALIBRATION_SHUNT] = { .gain = (MICROVOLTSPERSTEP_SHUNT << 12)
+						/ 20, .shift = 18 } //
+		};
+
+static calibration_channel channels[CALIBRATION_END];
+
+// raw per unit for going the other way, worked out when the calibration
+// changes
+typedef struct {
+	uint16_t gain;
+	int8_t shift;
+} inverse;
+
+static inverse inverses[CALIBRATION_END];
+
+// the first point of a two point calibration
+static calibration_index firstwhich = CALIBRATION_END;
+static uint16_t firstraw, firstvalue;
+
+#define CRCSEED 0xff
+
+uint16_t calibration_apply(calibration_index which, uint16_t raw) {
+	calibration_channel* c = &channels[which];
+	int32_t value = (int32_t) (((uint32_t) raw * c->gain) >> c->shift)
+			+ c->offset;
+	if (value < 0)
+		return 0;
+	if (value > 0xffff)
+		return 0xffff;
+	return (uint16_t) value;
+}
+
+void calibration_firstpoint(calibration_index which, uint16_t raw,
+		uint16_t value) {
+	firstwhich = which;
+	firstraw = raw;
+	firstvalue = value;
+}
+
+// num / den as a normalised mantissa / 2^shift, the division is done a
+// bit at a time until the mantissa is big enough. returns false if the
+// result doesn't fit
+static bool calibration_divide(uint16_t num, uint16_t den,
+		uint16_t* mantissa, uint8_t* shift) {
+	uint32_t m = num / den;
+	uint32_t remainder = num % den;
+
+	if (m >= GAINMAX || num == 0)
+		return false;
+
+	*shift = 0;
+	while (m < GAINMIN) {
+		m <<= 1;
+		remainder <<= 1;
+		if (remainder >= den) {
+			remainder -= den;
+			m |= 1;
+		}
+		(*shift)++;
+	}
+	*mantissa = m;
+	return true;
+}
+
+static void calibration_updateinverse(calibration_index which) {
+	uint16_t m;
+	uint8_t shift;
+
+	// 1 / (gain / 2^shift) is 2^shift / gain
+	calibration_divide(1, channels[which].gain, &m, &shift);
+	inverses[which].gain = m;
+	inverses[which].shift = shift - channels[which].shift;
+}
+
+// the raw reading that would give value, for setting up thresholds
+uint16_t calibration_unapply(calibration_index which, uint16_t value) {
+	inverse* inv = &inverses[which];
+	int32_t shifted = (int32_t) value - channels[which].offset;
+	uint32_t raw;
+
+	if (shifted <= 0)
+		return 0;
+	if (inv->shift < 0)
+		return 0xffff;
+
+	raw = ((uint32_t) shifted * inv->gain) >> inv->shift;
+	if (raw > 0xffff)
+		return 0xffff;
+	return (uint16_t) raw;
+}
+
+// works out the gain and offset for the line through both points
+bool calibration_secondpoint(calibration_index which, uint16_t raw,
+		uint16_t value) {
+	calibration_channel c;
+	int32_t offset;
+
+	if (which != firstwhich || raw <= firstraw || value <= firstvalue)
+		return false;
+
+	if (!calibration_divide(value - firstvalue, raw - firstraw, &c.gain,
+			&c.shift))
+		return false;
+	offset = (int32_t) firstvalue
+			- (int32_t) (((uint32_t) firstraw * c.gain) >> c.shift);
+	if (offset < -32768 || offset > 32767)
+		return false;
+	c.offset = offset;
+
+	channels[which] = c;
+	calibration_updateinverse(which);
+	firstwhich = CALIBRATION_END;
+	return true;
+}
+
+void calibration_reset(void) {
+	uint8_t i;
+	for (i = 0; i < CALIBRATION_END; i++) {
+		channels[i] = defaults[i];
+		calibration_updateinverse(i);
+	}
+}
+
+// the coefficients go into the eeprom with a crc after them
+void calibration_save(void) {
+	uint8_t* bytes = (uint8_t*) channels;
+	uint8_t crc = crc8(CRCSEED, bytes, sizeof(channels));
+
+	eeprom_writeblocking(EEPROM_CALIBRATION, bytes, sizeof(channels));
+	eeprom_writeblocking(EEPROM_CALIBRATION + sizeof(channels), &crc, 1);
+}
+
+// anything that doesn't look right in the eeprom means the unit has never
+// been calibrated and gets the defaults
+void calibration_init(void) {
+	calibration_channel stored[CALIBRATION_END];
+	uint8_t* bytes = (uint8_t*) stored;
+	uint8_t i;
+
+	for (i = 0; i < sizeof(stored); i++)
+		bytes[i] = eeprom_read(EEPROM_CALIBRATION + i);
+
+	if (crc8(CRCSEED, bytes, sizeof(stored))
+			!= eeprom_read(EEPROM_CALIBRATION + sizeof(stored))) {
+		calibration_reset();
+		return;
+	}
+
+	for (i = 0; i < CALIBRATION_END; i++) {
+		if (stored[i].gain < GAINMIN || stored[i].gain >= GAINMAX
+				|| stored[i].shift > 31) {
+			calibration_reset();
+			return;
+		}
+		channels[i] = stored[i];
+		calibration_updateinverse(i);
+	}
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// raw readings going in are averaged adc counts scaled by 2^6 so they
+// keep whatever oversampling added, 1023 counts is 0xffc0
+#define CALIBRATION_RAWSHIFT 6
+
+typedef enum {
+	CALIBRATION_VIN, // mV
+	CALIBRATION_VINHIGHGAIN, // mV
+	CALIBRATION_SHUNT, // mA
+	CALIBRATION_END
+} calibration_index;
+
+// value = ((raw * gain) >> shift) + offset, gain is kept between 2^13
+// and 2^14 so the product always fits in 32 bits
+typedef struct {
+	uint16_t gain;
+	uint8_t shift;
+	int16_t offset;
+} calibration_channel;
+
+uint16_t calibration_apply(calibration_index which, uint16_t raw);
+uint16_t calibration_unapply(calibration_index which, uint16_t value);
+void calibration_firstpoint(calibration_index which, uint16_t raw,
+		uint16_t value);
+bool calibration_secondpoint(calibration_index which, uint16_t raw,
+		uint16_t value);
+void calibration_reset(void);
+void calibration_save(void);
+void calibration_init(void);
@@ -0,0 +1,141 @@
+#include "datalog.h"
+#include "eeprom.h"
+#include "state.h"
+#include "timer.h"
+
+#define RAMRECORDS 32
+
+// the eeprom log starts with the number of records in it and the layout
+// they were written with, it fills up once and then stops so the start of
+// a run is never lost
+#define EEPROMCOUNT EEPROM_LOG
+#define EEPROMFORMAT (EEPROM_LOG + 2)
+#define EEPROMHEADER 3
+#define EEPROMRECORDS ((EEPROM_LOGSIZE - EEPROMHEADER) / sizeof(datalog_record))
+#define EEPROMRECORD(n) (EEPROM_LOG + EEPROMHEADER + ((n) * sizeof(datalog_record)))
+
+// goes up whenever datalog_record changes, 1 was the 16 bit time
+#define FORMAT 2
+
+static datalog_record records[RAMRECORDS];
+static uint8_t head = 0;
+static uint8_t count = 0;
+
+static datalog_storage storage = DATALOG_RAM;
+static uint16_t eepromcount = 0;
+
+// record being copied into the eeprom a byte at a time
+static datalog_record spill;
+static uint8_t spillpos = sizeof(datalog_record);
+static bool countdirty = false;
+
+// 0 turns logging off
+static uint16_t rate = 0;
+static uint32_t nextrecord = 0;
+
+static void datalog_add(uint32_t now) {
+	datalog_record* r = &records[head];
+	r->time = now;
+	r->volts = volts;
+	r->amps = amps;
+
+	head = (head + 1) % RAMRECORDS;
+	if (count < RAMRECORDS)
+		count++;
+
+	// if the last one is still going out this one only makes it into ram
+	if (storage == DATALOG_EEPROM && spillpos == sizeof(datalog_record)
+			&& eepromcount < EEPROMRECORDS) {
+		spill = *r;
+		spillpos = 0;
+	}
+}
+
+static void datalog_spill(void) {
+	uint8_t* bytes = (uint8_t*) &spill;
+
+	if (spillpos < sizeof(datalog_record)) {
+		if (eeprom_write(EEPROMRECORD(eepromcount) + spillpos,
+				bytes[spillpos])) {
+			spillpos++;
+			if (spillpos == sizeof(datalog_record)) {
+				eepromcount++;
+				countdirty = true;
+			}
+		}
+	} else if (countdirty) {
+		if (eeprom_write(EEPROMCOUNT, eepromcount & 0xff)
+				&& eeprom_write(EEPROMCOUNT + 1, eepromcount >> 8))
+			countdirty = false;
+	}
+}
+
+// restarts the record timing with the run time
+void datalog_start(void) {
+	nextrecord = 0;
+}
+
+// call on every reading, records are taken every rate seconds of run time
+void datalog_update(void) {
+	uint32_t now = timer_runtime();
+
+	if (state_loadon() && rate != 0 && now >= nextrecord) {
+		datalog_add(now);
+		nextrecord = now + rate;
+	}
+
+	datalog_spill();
+}
+
+void datalog_setrate(uint16_t seconds) {
+	rate = seconds;
+}
+
+void datalog_setstorage(datalog_storage newstorage) {
+	storage = newstorage;
+}
+
+void datalog_clear(void) {
+	head = 0;
+	count = 0;
+	if (storage == DATALOG_EEPROM) {
+		spillpos = sizeof(datalog_record);
+		eepromcount = 0;
+		countdirty = true;
+	}
+}
+
+uint16_t datalog_count(void) {
+	if (storage == DATALOG_EEPROM)
+		return eepromcount;
+	return count;
+}
+
+// oldest first
+void datalog_getrecord(uint16_t index, datalog_record* record) {
+	uint8_t i;
+	uint8_t* bytes = (uint8_t*) record;
+
+	if (storage == DATALOG_EEPROM) {
+		for (i = 0; i < sizeof(datalog_record); i++)
+			bytes[i] = eeprom_read(EEPROMRECORD(index) + i);
+	} else
+		*record = records[(head + RAMRECORDS - count + index) % RAMRECORDS];
+}
+
+void datalog_init(void) {
+	uint8_t header[EEPROMHEADER] = { 0, 0, FORMAT };
+
+	// a log from older firmware can't be read back with this layout,
+	// blank eeprom reads as format 0
+	if (eeprom_read(EEPROMFORMAT) != FORMAT) {
+		eepromcount = 0;
+		eeprom_writeblocking(EEPROM_LOG, header, sizeof(header));
+		return;
+	}
+
+	eepromcount = eeprom_read(EEPROMCOUNT)
+			| (eeprom_read(EEPROMCOUNT + 1) << 8);
+	if (eepromcount > EEPROMRECORDS)
+		eepromcount = 0;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+	uint32_t time;
+	uint16_t volts;
+	uint16_t amps;
+} datalog_record;
+
+typedef enum {
+	DATALOG_RAM, DATALOG_EEPROM
+} datalog_storage;
+
+void datalog_start(void);
+void datalog_update(void);
+void datalog_setrate(uint16_t seconds);
+void datalog_setstorage(datalog_storage storage);
+void datalog_clear(void);
+uint16_t datalog_count(void);
+void datalog_getrecord(uint16_t index, datalog_record* record);
+void datalog_init(void);
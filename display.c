@@ -3,7 +3,10 @@
 #include "stm8.h"
 #include "display.h"
 #include "util.h"
+#include "bcd.h"
 #include "state.h"
+#include "perf.h"
+#include "timer.h"
 
 typedef struct {
 	volatile uint8_t* odr;
@@ -27,6 +30,8 @@ typedef enum {
 	CHAR_P,
 	CHAR_H,
 	CHAR_T,
+	CHAR_E,
+	CHAR_LITTLER,
 	CHAR_SPACE
 } character;
 
@@ -84,6 +89,11 @@ static characterbits cbits[] = {
 		// t
 		{ .pbbits = 1, .pcbits = (1 << 7) | (1 << 4), .pdbits = (1 << 2),
 				.pebits = 0 },
+		// E
+		{ .pbbits = 1, .pcbits = (1 << 7) | (1 << 4), .pdbits = (1 << 2)
+				| (1 << 1), .pebits = 0 },
+		// Little R
+		{ .pbbits = 1, .pcbits = (1 << 4), .pdbits = 0, .pebits = 0 },
 		// SPACE
 		{ .pbbits = 0, .pcbits = 0, .pdbits = 0, .pebits = 0 } };
 
@@ -92,26 +102,30 @@ static digit digits[] = { { .odr = PD_ODR, .bit = 4 },
 		{ .odr = PC_ODR, .bit = 3 }, //
 		{ .odr = PC_ODR, .bit = 2 } };
 
-static character currentchars[4];
-static int dotpos = 0;
+// everything the display owns on each port, the other pins are left alone
+#define SEGMENTS_PB (1 << 0)
+#define SEGMENTS_PC ((1 << 7) | (1 << 6) | (1 << 4))
+#define SEGMENTS_PD ((1 << 2) | (1 << 1))
+#define SEGMENTS_PE (1 << 5)
+#define DOT_PD 1
+#define SELECT_PC ((1 << 5) | (1 << 3) | (1 << 2))
+#define SELECT_PD (1 << 4)
 
-static void setdigit(character c, bool dot) {
-	*PB_ODR &= ~cbits[CHAR_EIGHT].pbbits;
-	*PC_ODR &= ~cbits[CHAR_EIGHT].pcbits;
-	*PD_ODR &= ~cbits[CHAR_EIGHT].pdbits;
-	*PE_ODR &= ~cbits[CHAR_EIGHT].pebits;
+// how long the digit being set is on and then off for
+#define BLINKMILLIS 0x200
 
-	*PB_ODR |= cbits[c].pbbits;
-	*PC_ODR |= cbits[c].pcbits;
-	*PD_ODR |= cbits[c].pdbits;
-	*PE_ODR |= cbits[c].pebits;
-
-	if (dot)
-		*PD_ODR |= 1;
-	else
-		*PD_ODR &= ~1;
+// what goes on the ports while a digit is lit
+typedef struct {
+	uint8_t pb;
+	uint8_t pc;
+	uint8_t pd;
+	uint8_t pe;
+} portimage;
 
-}
+// display_update fills in the buffer the isr isn't using and then flips
+// front over so the isr never sees a half written frame
+static portimage images[2][4];
+static volatile uint8_t front = 0;
 
 static inline void turnonled() {
 	//*PB_ODR |= (1 << 1);
@@ -121,121 +135,182 @@ static inline void turnoffled() {
 	//*PB_ODR &= ~(1 << 1);
 }
 
-static int last = 0;
+static void display_buildimage(portimage* image, uint8_t digit, character c,
+		bool dot) {
+	image->pb = cbits[c].pbbits;
+	image->pc = cbits[c].pcbits | SELECT_PC;
+	image->pd = cbits[c].pdbits | SELECT_PD;
+	image->pe = cbits[c].pebits;
 
-static inline void toggleled() {
-	if (last == 0) {
-		if (*PB_ODR & (1 << 1))
-			turnoffled();
-		else
-			turnonled();
-	}
+	if (dot)
+		image->pd |= DOT_PD;
+
+	// the select lines are active low
+	if (digits[digit].odr == PC_ODR)
+		image->pc &= ~(1 << digits[digit].bit);
+	else
+		image->pd &= ~(1 << digits[digit].bit);
 }
 
 void display_refresh(void)
 __interrupt(INTERRUPT_TIM4) {
-	character ch;
-	bool dot;
-	int digit = last & 0x03;
+	static uint8_t digit = 0;
+	portimage* image;
 
-	*digits[digit].odr |= (1 << digits[digit].bit);
-	last++;
-	digit = last & 0x03;
-	dot = (dotpos == digit);
-	ch = currentchars[digit];
+	perf_enter(PERF_DISPLAYISR);
+	digit = (digit + 1) & 0x03;
+	image = &images[front][digit];
 
-	switch (om) {
-		case OPMODE_ON:
-		turnonled();
-		break;
-		case OPMODE_OFF:
-		turnoffled();
-		break;
-		case OPMODE_SET:
-		if((digit == digitbeingset) && (last < 0x7f))
-		ch = CHAR_SPACE;
-		if(digit == 3)
-		dot = (om == OPMODE_SET);
-		break;
-		case OPMODE_LVC:
-		toggleled();
-		break;
-	}
+	// turn the last digit off first so it doesn't get a glimpse of the
+	// next one's segments
+	*PC_ODR |= SELECT_PC;
+	*PD_ODR |= SELECT_PD;
 
-	setdigit(ch, dot);
-	*digits[digit].odr &= ~(1 << digits[digit].bit);
+	*PB_ODR = (*PB_ODR & ~SEGMENTS_PB) | image->pb;
+	*PE_ODR = (*PE_ODR & ~SEGMENTS_PE) | image->pe;
+	*PC_ODR = (*PC_ODR & ~(SEGMENTS_PC | SELECT_PC)) | image->pc;
+	*PD_ODR = (*PD_ODR & ~(SEGMENTS_PD | DOT_PD | SELECT_PD)) | image->pd;
 
 	TIM4_SR &= ~TIM4_SR_UIF;
+	perf_exit(PERF_DISPLAYISR);
 }
 
 void display_update(void) {
 
 	static character unit = CHAR_SPACE;
 
-	uint16_t millis;
-	uint16_t units;
+	uint16_t minutes;
+	uint32_t seconds = 0, longvalue;
 
 	uint16_t value = 1;
 
-	uint16_t splittmp[3];
-	int digit = 0;
-	int pos;
+	// room for three digits of minutes and two of seconds
+	uint8_t splittmp[5];
+	uint8_t whole, first = 0;
+	uint8_t i;
+
+	character chars[4];
+	uint8_t dotpos;
+	bool blinkoff = (timer_millis() & BLINKMILLIS) != 0;
+	portimage* back = images[front ^ 1];
+	character ch;
+	state_snapshot snapshot;
+
+	perf_enter(PERF_DISPLAYUPDATE);
+	state_getsnapshot(&snapshot);
 
 	switch (dm) {
 	case VOLTS:
-		unit = highgain ? CHAR_LITTLEV : CHAR_V;
-		if (om == OPMODE_SET)
+		unit = snapshot.highgain ? CHAR_LITTLEV : CHAR_V;
+		if (snapshot.om == OPMODE_SET)
 			value = lvc;
 		else
-			value = volts;
+			value = snapshot.volts;
 		break;
 	case AMPS:
 		unit = CHAR_A;
-		if (om == OPMODE_SET)
-			value = targetamps;
-		else
-			value = amps;
+		if (snapshot.om == OPMODE_SET) {
+			// the setpoint for the regulation mode
+			value = *state_setpoint();
+			if (rm == REGMODE_CR)
+				unit = CHAR_LITTLER;
+			else if (rm == REGMODE_CP)
+				unit = CHAR_P;
+		} else
+			value = snapshot.amps;
 		break;
 	case AMPHOURS:
 		unit = CHAR_H;
-		value = amphours;
+		value = snapshot.amphours;
 		break;
 	case WATTS:
 		unit = CHAR_P;
-		value = watts;
+		value = snapshot.watts;
+		break;
+	case WATTHOURS:
+		unit = CHAR_E;
+		value = snapshot.watthours > 0xffff ? 0xffff : snapshot.watthours;
 		break;
 	case TIME:
 		unit = CHAR_T;
-		value = time;
+		seconds = snapshot.time;
+		break;
+	case RESISTANCE:
+		unit = CHAR_LITTLER;
+		value = snapshot.resistance;
+		break;
+	case DISPMODE_END:
 		break;
 	}
 
-	if (dm == TIME) {
-		millis = value % 60;
-		units = (value - millis) / 60;
+	if (dm == TIME && seconds < 60000) {
+		value = seconds;
+		// value / 60, exact for all 16 bit values
+		minutes = ((uint32_t) value * 34953) >> 21;
+		whole = bcd_splitsuppressed(minutes, splittmp, 3);
+		bcd_split(value - ((minutes << 6) - (minutes << 2)), &splittmp[whole],
+				2);
+	} else if (dm == TIME) {
+		// hours and minutes once the minutes don't fit
+		longvalue = seconds / 60;
+		if (longvalue >= 1000UL * 60)
+			longvalue = (1000UL * 60) - 1;
+		minutes = (uint16_t) longvalue;
+		value = ((uint32_t) minutes * 34953) >> 21;
+		whole = bcd_splitsuppressed(value, splittmp, 3);
+		bcd_split(minutes - ((value << 6) - (value << 2)), &splittmp[whole],
+				2);
+	} else if (dm == WATTHOURS && snapshot.watthours > 0xffff) {
+		// tenths of a Wh past 65.535Wh, up to 999.9
+		longvalue = snapshot.watthours / 100;
+		bcd_split(longvalue > 9999 ? 9999 : longvalue, splittmp, 5);
+		while (first < 2 && splittmp[first] == 0)
+			first++;
+		whole = 4 - first;
 	} else {
-		millis = value % 1000;
-		units = (value - millis) / 1000;
+		// 65535 is the most there can be so the whole part is two digits
+		bcd_split(value, splittmp, 5);
+		if (splittmp[0] == 0)
+			first = 1;
+		whole = 2 - first;
 	}
 
-	split(units, splittmp, 3);
-	for (pos = 0; pos < 3; pos++) {
-		if (splittmp[pos] != 0 || pos == 2) {
-			currentchars[digit] = (character) splittmp[pos];
-			if (pos == 2)
-				dotpos = digit;
-			digit++;
-		}
-	}
+	for (i = 0; i < 3; i++)
+		chars[i] = (character) splittmp[first + i];
+	dotpos = whole - 1;
+
+	chars[3] = unit;
 
-	split(millis, splittmp, 3);
-	pos = dm == TIME ? 1 : 0;
-	for (; pos < 3 && digit < 3; pos++) {
-		currentchars[digit] = (character) splittmp[pos];
-		digit++;
+	switch (snapshot.om) {
+	case OPMODE_ON:
+	case OPMODE_TRANSIENT:
+		turnonled();
+		break;
+	case OPMODE_OFF:
+	case OPMODE_SET:
+		turnoffled();
+		break;
+	case OPMODE_LVC:
+	case OPMODE_OCP:
+	case OPMODE_OPP:
+		if (blinkoff)
+			turnoffled();
+		else
+			turnonled();
+		break;
 	}
 
-	currentchars[digit] = unit;
+	for (i = 0; i < 4; i++) {
+		ch = chars[i];
+		// the digit being set blinks and the dot on the unit shows
+		// that we're setting something
+		if (snapshot.om == OPMODE_SET && i == digitbeingset && blinkoff)
+			ch = CHAR_SPACE;
+		display_buildimage(&back[i], i, ch,
+				(i == dotpos) || (i == 3 && snapshot.om == OPMODE_SET));
+	}
+	front ^= 1;
+	perf_exit(PERF_DISPLAYUPDATE);
 }
 
 void display_init(void) {
@@ -3,7 +3,7 @@
 #include "stm8.h"
 
 typedef enum {
-	VOLTS, AMPS, AMPHOURS, WATTS, TIME, DISPMODE_END
+	VOLTS, AMPS, AMPHOURS, WATTS, WATTHOURS, TIME, RESISTANCE, DISPMODE_END
 } displaymode;
 
 void display_init(void);
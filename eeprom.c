@@ -0,0 +1,58 @@
+#include "stm8.h"
+#include "eeprom.h"
+#include "watchdog.h"
+
+static bool writing = false;
+
+// reading IAPSR clears EOP so it's only ever read here
+static uint8_t eeprom_status(void) {
+	uint8_t status = FLASH_IAPSR;
+	if (status & FLASH_IAPSR_EOP)
+		writing = false;
+	return status;
+}
+
+static void eeprom_unlock(void) {
+	if (!(eeprom_status() & FLASH_IAPSR_DUL)) {
+		FLASH_DUKR = FLASH_DUKR_KEY1;
+		FLASH_DUKR = FLASH_DUKR_KEY2;
+		while (!(eeprom_status() & FLASH_IAPSR_DUL)) {
+		}
+	}
+}
+
+uint8_t eeprom_read(uint16_t offset) {
+	return EEPROM(offset);
+}
+
+bool eeprom_busy(void) {
+	if (writing)
+		eeprom_status();
+	return writing;
+}
+
+// starts programming a byte, returns false without doing anything if the
+// last write hasn't finished yet
+bool eeprom_write(uint16_t offset, uint8_t value) {
+	if (eeprom_busy())
+		return false;
+
+	if (EEPROM(offset) != value) {
+		eeprom_unlock();
+		writing = true;
+		EEPROM(offset) = value;
+	}
+	return true;
+}
+
+// for settings, waits for each byte so it can take a few ms per byte
+void eeprom_writeblocking(uint16_t offset, uint8_t* buffer, uint8_t len) {
+	for (; len > 0; len--) {
+		while (!eeprom_write(offset, *buffer))
+			watchdog_kick();
+		offset++;
+		buffer++;
+	}
+	while (eeprom_busy())
+		watchdog_kick();
+}
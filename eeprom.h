@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// layout of the data eeprom
+#define EEPROM_CALIBRATION	0x000
+#define EEPROM_SEQUENCE	0x040
+#define EEPROM_UNITID	0x0ff
+#define EEPROM_LOG		0x100
+#define EEPROM_LOGSIZE	(EEPROM_SIZE - EEPROM_LOG)
+
+uint8_t eeprom_read(uint16_t offset);
+bool eeprom_busy(void);
+bool eeprom_write(uint16_t offset, uint8_t value);
+void eeprom_writeblocking(uint16_t offset, uint8_t* buffer, uint8_t len);
@@ -0,0 +1,64 @@
+#include "energy.h"
+#include "state.h"
+#include "timer.h"
+
+// the accumulators are in mA*us and mW*us
+#define MICROSECONDSPERHOUR 3600000000UL
+
+// longer gaps than this are integrated in pieces so the accumulators
+// can't overflow
+#define MAXINTERVAL 10000
+
+static uint32_t charge = 0;
+static uint32_t energy = 0;
+static timer_stamp lastupdate;
+// cycles short of a whole us from the last update
+static uint8_t leftover = 0;
+
+static uint16_t energy_accumulate(uint32_t* accumulator, uint16_t value,
+		uint16_t interval, uint16_t total) {
+	*accumulator += (uint32_t) value * interval;
+	if (*accumulator >= MICROSECONDSPERHOUR) {
+		*accumulator -= MICROSECONDSPERHOUR;
+		if (total != 0xffff)
+			total++;
+	}
+	return total;
+}
+
+void energy_reset(void) {
+	charge = 0;
+	energy = 0;
+	amphours = 0;
+	watthours = 0;
+	leftover = 0;
+	timer_getstamp(&lastupdate);
+}
+
+static void energy_integrate(uint16_t interval) {
+	amphours = energy_accumulate(&charge, amps, interval, amphours);
+	// a whole battery has to fit, so this one has 32 bits
+	energy += (uint32_t) watts * interval;
+	if (energy >= MICROSECONDSPERHOUR) {
+		energy -= MICROSECONDSPERHOUR;
+		if (watthours != 0xffffffff)
+			watthours++;
+	}
+}
+
+// integrates the latest readings over the time since the last ones, slow
+// readings and main loop stalls still count in full
+void energy_update(void) {
+	timer_stamp now;
+	uint32_t cycles, interval;
+
+	timer_getstamp(&now);
+	cycles = timer_cyclesbetween(&lastupdate, &now) + leftover;
+	lastupdate = now;
+	leftover = cycles & 0xf;
+	interval = cycles >> 4;
+
+	for (; interval > MAXINTERVAL; interval -= MAXINTERVAL)
+		energy_integrate(MAXINTERVAL);
+	energy_integrate((uint16_t) interval);
+}
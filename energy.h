@@ -0,0 +1,4 @@
+#pragma once
+
+void energy_reset(void);
+void energy_update(void);
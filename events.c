@@ -0,0 +1,33 @@
+#include "stm8.h"
+#include "events.h"
+
+volatile uint8_t events = 0;
+
+// returns whatever is pending without waiting
+uint8_t events_take(void) {
+	uint8_t pending;
+	disableInterrupts();
+	pending = events;
+	events = 0;
+	enableInterrupts();
+	return pending;
+}
+
+// sleeps until at least one event has been posted and returns all of
+// the pending ones
+uint8_t events_wait(void) {
+	uint8_t pending;
+
+	// wfi unmasks interrupts as it goes to sleep so an event can't sneak
+	// in between the check and the wait
+	disableInterrupts();
+	while (events == 0) {
+		waitforinterrupt();
+		disableInterrupts();
+	}
+	pending = events;
+	events = 0;
+	enableInterrupts();
+
+	return pending;
+}
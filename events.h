@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+// posted by the isrs to wake up the main loop
+#define EVENT_ADC		(1 << 0)
+#define EVENT_UARTRX	(1 << 1)
+#define EVENT_BUTTONS	(1 << 2)
+#define EVENT_TICK		(1 << 3)
+
+extern volatile uint8_t events;
+
+// only call from an isr, they don't nest so this can't be interrupted
+#define events_post(event) (events |= (event))
+
+uint8_t events_take(void);
+uint8_t events_wait(void);
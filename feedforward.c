@@ -0,0 +1,127 @@
+#include "feedforward.h"
+#include "state.h"
+#include "adc.h"
+#include "load.h"
+#include "regulator.h"
+#include "setpoint.h"
+
+// a duty of 0 is a point that hasn't been learned yet
+static feedforward_point points[2][FEEDFORWARD_BINS];
+
+static bool sweeping = false;
+static uint16_t sweepmax;
+static uint16_t sweepduty;
+static uint8_t sweepreadings;
+
+// interpolates between the learned points either side of target, with no
+// current at the max duty below the first one. above the last one it
+// stays at that point's duty so it never overshoots
+uint16_t feedforward_duty(uint16_t target) {
+	feedforward_point* range = points[highgain];
+	feedforward_point lower = { .amps = 0, .duty = LOAD_MAXDUTY };
+	feedforward_point* upper = 0;
+	uint8_t i;
+
+	for (i = 0; i < FEEDFORWARD_BINS; i++) {
+		if (range[i].duty == 0)
+			continue;
+		if (range[i].amps <= target)
+			lower = range[i];
+		else {
+			upper = &range[i];
+			break;
+		}
+	}
+
+	// noise can leave neighbouring points the wrong way round
+	if (upper == 0 || upper->duty >= lower.duty)
+		return lower.duty;
+
+	// more current is less duty
+	return lower.duty
+			- (uint16_t) (((uint32_t) (lower.duty - upper->duty)
+					* (target - lower.amps)) / (upper->amps - lower.amps));
+}
+
+// averaged with what's already there
+static void feedforward_learnpoint(uint16_t actual, uint16_t duty) {
+	uint8_t bin = actual >> FEEDFORWARD_BINSHIFT;
+	feedforward_point* point;
+
+	if (bin >= FEEDFORWARD_BINS)
+		return;
+
+	point = &points[highgain][bin];
+	if (point->duty == 0) {
+		point->amps = actual;
+		point->duty = duty;
+	} else {
+		point->amps = (point->amps + actual) >> 1;
+		point->duty = (point->duty + duty) >> 1;
+	}
+}
+
+// only takes the point once actual has settled at target
+void feedforward_learn(uint16_t target, uint16_t actual, uint16_t duty) {
+	uint16_t tolerance = target >> FEEDFORWARD_SETTLEDSHIFT;
+	if (target != 0 && actual + tolerance >= target && actual <= target + tolerance)
+		feedforward_learnpoint(actual, duty);
+}
+
+void feedforward_clear(void) {
+	uint8_t i;
+	for (i = 0; i < FEEDFORWARD_BINS; i++) {
+		points[0][i].duty = 0;
+		points[1][i].duty = 0;
+	}
+}
+
+bool feedforward_getpoint(bool highgainrange, uint8_t bin,
+		feedforward_point* point) {
+	*point = points[highgainrange][bin];
+	return point->duty != 0;
+}
+
+// steps the duty down from the max while the load is on and learns a
+// point at each step until the current gets to maxamps
+bool feedforward_sweep(uint16_t maxamps) {
+	if (om != OPMODE_ON || sweeping || maxamps == 0)
+		return false;
+
+	sweepmax = maxamps;
+	sweepduty = LOAD_MAXDUTY;
+	sweepreadings = 0;
+	load_setduty(sweepduty);
+	sweeping = true;
+	return true;
+}
+
+void feedforward_stop(void) {
+	sweeping = false;
+}
+
+// true while a sweep has the duty
+bool feedforward_update(void) {
+	uint16_t duty;
+
+	if (!sweeping)
+		return false;
+
+	if (++sweepreadings <= ADC_STALEREADINGS)
+		return true;
+	sweepreadings = 0;
+
+	feedforward_learnpoint(amps, sweepduty);
+	if (amps >= sweepmax || sweepduty < LOAD_MINDUTY + FEEDFORWARD_SWEEPSTEP) {
+		// back to the setpoint, straight from the new map
+		sweeping = false;
+		duty = feedforward_duty(setpoint_targetamps());
+		load_setduty(duty);
+		regulator_reset(duty);
+		return true;
+	}
+
+	sweepduty -= FEEDFORWARD_SWEEPSTEP;
+	load_setduty(sweepduty);
+	return true;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// a map of the duty it takes to get a current, learned from the regulator
+// once it has settled, so a new setpoint can start from close to the right
+// duty instead of the integrator having to wind its way there
+
+// one point per 2^FEEDFORWARD_BINSHIFT mA for each voltage range
+#define FEEDFORWARD_BINSHIFT 10
+#define FEEDFORWARD_BINS 8
+
+// learned from when the current is within target / 2^SETTLEDSHIFT
+#define FEEDFORWARD_SETTLEDSHIFT 5
+
+// mA, setpoint moves bigger than this start over from the map
+#define FEEDFORWARD_JUMP 100
+
+// duty counts per step of a sweep
+#define FEEDFORWARD_SWEEPSTEP 16
+
+typedef struct {
+	uint16_t amps;
+	uint16_t duty;
+} feedforward_point;
+
+uint16_t feedforward_duty(uint16_t target);
+void feedforward_learn(uint16_t target, uint16_t actual, uint16_t duty);
+void feedforward_clear(void);
+bool feedforward_getpoint(bool highgainrange, uint8_t bin,
+		feedforward_point* point);
+bool feedforward_sweep(uint16_t maxamps);
+void feedforward_stop(void);
+bool feedforward_update(void);
@@ -0,0 +1,124 @@
+#include "ir.h"
+#include "state.h"
+#include "adc.h"
+#include "load.h"
+#include "regulator.h"
+#include "setpoint.h"
+#include "feedforward.h"
+#include "timer.h"
+#include "thermal.h"
+
+typedef enum {
+	IR_IDLE, IR_BASE, IR_PULSE
+} irphase;
+
+static irphase phase = IR_IDLE;
+static uint16_t pulseamps, pulsems;
+// the duty is left alone once the current is close enough
+static bool holding;
+static uint16_t readings;
+static uint32_t edge;
+
+static uint16_t basevolts, baseamps, baseduty;
+static bool valid = false;
+
+bool ir_start(uint16_t newpulseamps, uint16_t newpulsems) {
+	if (om != OPMODE_ON || rm != REGMODE_CC || phase != IR_IDLE
+			|| newpulseamps <= targetamps || newpulsems == 0
+			|| newpulsems > IR_MAXPULSEMS)
+		return false;
+
+	pulseamps = newpulseamps;
+	pulsems = newpulsems;
+	holding = false;
+	readings = 0;
+	valid = false;
+	phase = IR_BASE;
+	return true;
+}
+
+void ir_stop(void) {
+	phase = IR_IDLE;
+}
+
+// back to the setpoint with the duty it had before the pulse
+static void ir_finish(bool ok) {
+	if (phase == IR_PULSE) {
+		load_setduty(baseduty);
+		regulator_reset(baseduty);
+	} else
+		regulator_reset(load_getduty());
+	valid = ok;
+	phase = IR_IDLE;
+}
+
+// runs the measurement with the latest readings, true if it's looked
+// after the duty and the regulator has to leave it alone
+bool ir_update(void) {
+	uint16_t target, pulse, tolerance;
+	uint16_t dv, di;
+
+	if (phase == IR_IDLE)
+		return false;
+
+	if (phase == IR_PULSE) {
+		// the sample is the first reading that's all from inside the pulse
+		// once the pulse length is up
+		if (++readings <= ADC_STALEREADINGS
+				|| timer_millis() - edge < pulsems)
+			return true;
+		// the voltage sags under the extra current
+		if (amps <= baseamps) {
+			ir_finish(false);
+			return true;
+		}
+		dv = volts < basevolts ? basevolts - volts : 0;
+		di = amps - baseamps;
+		resistance = setpoint_divide(dv, di);
+		ir_finish(true);
+		return true;
+	}
+
+	// both sides are derated with the temperature like the setpoint is
+	target = thermal_derate(targetamps);
+	if (!holding) {
+		tolerance = target >> IR_TOLERANCESHIFT;
+		if (amps + tolerance >= target && amps <= target + tolerance) {
+			holding = true;
+			readings = 0;
+		} else if (++readings >= IR_TIMEOUT) {
+			ir_finish(false);
+			return false;
+		} else
+			load_setduty(regulator_update(target, amps));
+		return true;
+	}
+
+	// the first readings with the duty held are still partly from while it
+	// was moving
+	if (++readings <= ADC_STALEREADINGS)
+		return true;
+
+	// derated that far there's no step left to measure
+	pulse = thermal_derate(pulseamps);
+	if (pulse <= target) {
+		ir_finish(false);
+		return false;
+	}
+
+	// the base sample is the reading straight before the edge
+	basevolts = volts;
+	baseamps = amps;
+	baseduty = load_getduty();
+	load_setduty(feedforward_duty(pulse));
+	edge = timer_millis();
+	readings = 0;
+	phase = IR_PULSE;
+	return true;
+}
+
+// the last measurement in mOhm, false if there isn't one or it failed
+bool ir_result(uint16_t* mohms) {
+	*mohms = resistance;
+	return valid;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// internal resistance from a current pulse on top of the constant current
+// setpoint. the base side is regulated and then held still, the pulse is
+// an open loop step to the feed forward duty for the pulse current that
+// lasts a set time and is read right at the end of it, so every pulse
+// looks the same to the battery
+
+// the base side has to get within target / 2^IR_TOLERANCESHIFT of its
+// current in this many readings or the measurement is given up
+#define IR_TOLERANCESHIFT 6
+#ifndef IR_TIMEOUT
+#define IR_TIMEOUT 250
+#endif
+
+// ms from the edge to the pulse sample, the pulse ends with it
+#define IR_DEFAULTPULSEMS 20
+#define IR_MAXPULSEMS 1000
+
+bool ir_start(uint16_t pulseamps, uint16_t pulsems);
+void ir_stop(void);
+bool ir_update(void);
+bool ir_result(uint16_t* mohms);
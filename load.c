@@ -3,17 +3,29 @@
 #include "stm8.h"
 #include "state.h"
 
-#define OFFDUTY 1024
+// transient_tick sets the duty from the timer isr, so the compare
+// register and the copy of it are only ever touched with it held off
+static uint16_t loadduty = OFFDUTY;
 
 static void load_reallysetduty(uint16_t duty) {
-	loadduty = duty;
-	TIM1_CCR1H = (uint8_t)((duty >> 8) & 0xff);
-	TIM1_CCR1L = (uint8_t)(duty & 0xff);
-	TIM1_EGR |= TIM1_EGR_UG;
+	__critical {
+		loadduty = duty;
+		TIM1_CCR1H = (uint8_t)((duty >> 8) & 0xff);
+		TIM1_CCR1L = (uint8_t)(duty & 0xff);
+		TIM1_EGR |= TIM1_EGR_UG;
+	}
+}
+
+uint16_t load_getduty(void) {
+	uint16_t duty;
+	__critical {
+		duty = loadduty;
+	}
+	return duty;
 }
 
 void load_setduty(uint16_t duty) {
-	if (duty > 300 && duty < OFFDUTY) {
+	if (duty >= LOAD_MINDUTY && duty <= LOAD_MAXDUTY) {
 		load_reallysetduty(duty);
 	}
 }
@@ -22,6 +34,22 @@ void load_turnoff(void) {
 	load_reallysetduty(OFFDUTY);
 }
 
+// takes the pwm output away from the timer straight away, the pin goes
+// back to its gpio level which is off. can be called from an isr
+void load_disableoutput(void) {
+	TIM1_BKR &= ~TIM1_BKR_MOE;
+}
+
+void load_enableoutput(void) {
+	TIM1_BKR |= TIM1_BKR_MOE;
+}
+
+// start an adc conversion on every nth update event
+void load_enableadctrigger(uint8_t periods) {
+	TIM1_RCR = periods - 1;
+	TIM1_CR2 |= TIM1_CR2_MMS_UPDATE;
+}
+
 void load_init(void) {
 	const uint16_t reloadvalue = OFFDUTY;
 
@@ -2,6 +2,16 @@
 
 #include <stdint.h>
 
+#define OFFDUTY 1024
+
+// range load_setduty() will accept
+#define LOAD_MINDUTY 301
+#define LOAD_MAXDUTY (OFFDUTY - 1)
+
 void load_turnoff(void);
+void load_disableoutput(void);
+void load_enableoutput(void);
 void load_setduty(uint16_t duty);
+uint16_t load_getduty(void);
+void load_enableadctrigger(uint8_t periods);
 void load_init(void);
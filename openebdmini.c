@@ -44,104 +44,216 @@
 #include "buttons.h"
 #include "load.h"
 #include "adc.h"
+#include "calibration.h"
+#include "protection.h"
+#include "transient.h"
+#include "ir.h"
+#include "sequence.h"
+#include "feedforward.h"
+#include "stats.h"
+#include "thermal.h"
 #include "timer.h"
 #include "protocol.h"
 #include "watchdog.h"
 #include "util.h"
-
-#define FANWATTTHRESHOLD	2500
+#include "regulator.h"
+#include "setpoint.h"
+#include "energy.h"
+#include "datalog.h"
+#include "events.h"
+#include "sched.h"
+#include "perf.h"
 
 static void initsystem(void) {
 	*CLK_CKDIVR = 0; // default is 2MHz, remove divider for 16MHz
 }
 
-static void initfan(void) {
-	setuppins(PB_DDR, PB_CR1, 1 << 2);
-}
-
 static void initserial(void) {
 	uart_configure();
 }
 
-static void turnonfan() {
-	*PB_ODR |= (1 << 2);
-}
-static void turnofffan() {
-	*PB_ODR &= ~(1 << 2);
+static int8_t volttrim = -1;
+
+// the target the regulator was last given
+static uint16_t lasttarget;
+
+// starts the regulator over from the learned duty for target
+static void jumpto(uint16_t target) {
+	uint16_t duty = feedforward_duty(target);
+	load_setduty(duty);
+	regulator_reset(duty);
+	lasttarget = target;
 }
 
-static int8_t volttrim = -1;
+static void regulate(void) {
+	uint16_t target = thermal_derate(setpoint_targetamps());
+	uint16_t duty;
+
+	if (target > lasttarget + FEEDFORWARD_JUMP
+			|| target + FEEDFORWARD_JUMP < lasttarget)
+		jumpto(target);
+	lasttarget = target;
+
+	duty = regulator_update(target, amps);
+	load_setduty(duty);
+	feedforward_learn(target, amps, duty);
+}
 
 static void checkstate(void) {
 	static operationmode lastmode = OPMODE_OFF;
+	operationmode tripped;
 
 	// stuff that only happens at mode changes
 	if (om != lastmode) {
 		switch (om) {
 		case OPMODE_ON:
+		case OPMODE_TRANSIENT:
+			jumpto(setpoint_targetamps());
+			energy_reset();
+			datalog_start();
 			timer_start();
+			protection_arm();
+			if (om == OPMODE_TRANSIENT)
+				transient_start();
 			break;
 		case OPMODE_LVC:
+		case OPMODE_OCP:
+		case OPMODE_OPP:
 		case OPMODE_OFF:
+			transient_stop();
+			ir_stop();
+			feedforward_stop();
+			protection_disarm();
 			load_turnoff();
 			timer_stop();
-			turnofffan();
+			break;
+		case OPMODE_SET:
+			// only comes from off
 			break;
 		}
 		lastmode = om;
 	}
 
 	// stuff that always has to happen while the load is on
-	if (om == OPMODE_ON) {
-		if (volts < lvc) {
+	if (state_loadon()) {
+		// the isr has already turned the output off for a trip
+		tripped = protection_tripped();
+		if (tripped != OPMODE_ON) {
+			load_turnoff();
+			om = tripped;
+		} else if (volts < lvc) {
 			load_turnoff();
 			om = OPMODE_LVC;
 		} else {
-			if (amps < targetamps) {
-				load_setduty(loadduty - 1);
-			} else if (amps > targetamps) {
-				load_setduty(loadduty + 1);
-			}
+			protection_update();
+			perf_enter(PERF_REGULATOR);
+			if (om == OPMODE_TRANSIENT)
+				transient_update();
+			else if (!ir_update() && !feedforward_update())
+				regulate();
+			perf_exit(PERF_REGULATOR);
+			energy_update();
 		}
 	}
 
-	if (watts > FANWATTTHRESHOLD)
-		turnonfan();
-	else
-		turnofffan();
+	sched_setcritical(state_loadon());
 }
 
-int main() {
-	bool newreadings;
-	bool buttonschanged;
+#if defined(ADC_TRACE) && defined(PERF)
+static bool benchreported = false;
+#endif
+
+static void controltask(uint8_t pending) {
+	(void) pending;
+	if (adc_updatereadings()) {
+		perf_enter(PERF_CHECKSTATE);
+		checkstate();
+		perf_exit(PERF_CHECKSTATE);
+		stats_update();
+		thermal_update();
+		if (sequence_update())
+			sched_post(EVENT_STATECHANGED);
+		state_publish();
+		datalog_update();
+		sched_post(EVENT_READINGS);
+#if defined(ADC_TRACE) && defined(PERF)
+		// benchmark runs report once the recording has been played through
+		if (adc_traceplayed() && !benchreported)
+			benchreported = protocol_sendperf();
+#endif
+	}
+}
 
+// releases don't interrupt so they get picked up by the tick
+static void buttonstask(uint8_t pending) {
+	(void) pending;
+	if (buttons_check()) {
+		state_publish();
+		sched_post(EVENT_STATECHANGED);
+	}
+}
+
+static void commandtask(uint8_t pending) {
+	(void) pending;
+	perf_enter(PERF_COMMANDS);
+	protocol_checkcommand();
+	// commands can change the mode
+	state_publish();
+	perf_exit(PERF_COMMANDS);
+}
+
+static void telemetrytask(uint8_t pending) {
+	perf_enter(PERF_TELEMETRY);
+	if (pending & EVENT_STATECHANGED)
+		protocol_sendstate();
+	else if (pending & EVENT_READINGS)
+		protocol_onreadings();
+	protocol_checkpending();
+	perf_exit(PERF_TELEMETRY);
+}
+
+static void displaytask(uint8_t pending) {
+	(void) pending;
+	display_update();
+}
+
+// runs last so a task hogging the cpu ends in a reset
+static void watchdogtask(uint8_t pending) {
+	(void) pending;
+	watchdog_kick();
+}
+
+static sched_task tasks[] = { //
+		{ .run = controltask, .events = EVENT_ADC, .budget = 500 }, //
+				{ .run = buttonstask, .events = EVENT_BUTTONS | EVENT_TICK,
+						.budget = 100 }, //
+				{ .run = commandtask, .events = EVENT_UARTRX, .budget = 2000 }, //
+				{ .run = telemetrytask, .events = EVENT_READINGS
+						| EVENT_STATECHANGED | EVENT_TICK, .budget = 1500 }, //
+				{ .run = displaytask, .events = EVENT_STATECHANGED, .period =
+						100, .budget = 1000 }, //
+				{ .run = watchdogtask, .events = EVENT_TICK, .budget = 10 } //
+		};
+
+int main() {
 	load_init();
 	initsystem();
 	watchdog_init();
 	initserial();
 	timer_init();
 	display_init();
-	initfan();
+	thermal_init();
+	calibration_init();
 	adc_init();
 
 	buttons_init();
+	protocol_init();
+	datalog_init();
+	sequence_init();
 
 	enableInterrupts();
 
 	protocol_onbooted();
 
-	while (1) {
-		watchdog_kick();
-		newreadings = adc_updatereadings();
-		if (newreadings) {
-			checkstate();
-		}
-		buttonschanged = buttons_check();
-		if (newreadings || buttonschanged) {
-			protocol_sendstate();
-			display_update();
-		}
-
-		protocol_checkcommand();
-	}
+	sched_run(tasks, sizeof(tasks) / sizeof(tasks[0]));
 }
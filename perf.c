@@ -0,0 +1,66 @@
+#include "perf.h"
+#include "timer.h"
+
+#ifdef PERF
+
+static const char* const names[] = { //
+		[PERF_ADCISR] = "ADCISR", //
+				[PERF_UARTTXISR] = "TXISR", //
+				[PERF_UARTRXISR] = "RXISR", //
+				[PERF_DISPLAYISR] = "DISPISR", //
+				[PERF_TIMERISR] = "TIMERISR", //
+				[PERF_ADCUPDATE] = "ADC", //
+				[PERF_CHECKSTATE] = "CONTROL", //
+				[PERF_TELEMETRY] = "TELEMETRY", //
+				[PERF_DISPLAYUPDATE] = "DISPLAY", //
+				[PERF_COMMANDS] = "COMMANDS", //
+				[PERF_REGULATOR] = "REGULATOR", //
+				[PERF_SENDSTATE] = "SENDSTATE", //
+				[PERF_SPLIT] = "SPLIT" //
+		};
+
+static timer_stamp starts[PERF_END];
+static perf_stats stats[PERF_END];
+
+// none of the points nest with themselves so one start each is enough
+void perf_doenter(perf_point point) {
+	timer_getstamp(&starts[point]);
+}
+
+void perf_doexit(perf_point point) {
+	uint32_t cycles = timer_cyclessince(&starts[point]);
+	perf_stats* s = &stats[point];
+
+	__critical {
+		if (s->calls == 0 || cycles < s->min)
+			s->min = cycles;
+		if (cycles > s->max)
+			s->max = cycles;
+		s->total += cycles;
+		s->calls++;
+	}
+}
+
+const char* perf_name(perf_point point) {
+	return names[point];
+}
+
+void perf_get(perf_point point, perf_stats* s) {
+	__critical {
+		*s = stats[point];
+	}
+}
+
+void perf_reset(void) {
+	perf_point point;
+	__critical {
+		for (point = 0; point < PERF_END; point++) {
+			stats[point].calls = 0;
+			stats[point].min = 0;
+			stats[point].max = 0;
+			stats[point].total = 0;
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+
+// places that get timed when built with PERF
+typedef enum {
+	PERF_ADCISR,
+	PERF_UARTTXISR,
+	PERF_UARTRXISR,
+	PERF_DISPLAYISR,
+	PERF_TIMERISR,
+	PERF_ADCUPDATE,
+	PERF_CHECKSTATE,
+	PERF_TELEMETRY,
+	PERF_DISPLAYUPDATE,
+	PERF_COMMANDS,
+	PERF_REGULATOR,
+	PERF_SENDSTATE,
+	PERF_SPLIT,
+	PERF_END
+} perf_point;
+
+// in 16MHz cpu cycles
+typedef struct {
+	uint32_t calls;
+	uint32_t min;
+	uint32_t max;
+	uint32_t total;
+} perf_stats;
+
+#ifdef PERF
+#define perf_enter(point) perf_doenter(point)
+#define perf_exit(point) perf_doexit(point)
+#else
+#define perf_enter(point)
+#define perf_exit(point)
+#endif
+
+void perf_doenter(perf_point point);
+void perf_doexit(perf_point point);
+const char* perf_name(perf_point point);
+void perf_get(perf_point point, perf_stats* stats);
+void perf_reset(void);
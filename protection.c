@@ -0,0 +1,113 @@
+#include "stm8.h"
+#include "protection.h"
+#include "adc.h"
+#include "calibration.h"
+#include "setpoint.h"
+#include "load.h"
+
+// OPMODE_ON while nothing has tripped
+static volatile operationmode tripped = OPMODE_ON;
+static volatile bool armed = false;
+
+// in adc counts, the analog watchdog gets whichever of ocp and opp is
+// lower right now
+static uint16_t lvcraw[2];
+static uint16_t ocpraw;
+// consecutive scans under the lvc threshold, one odd conversion
+// shouldn't end a run
+static uint8_t lvcscans;
+
+static void protection_trip(operationmode cause) {
+	load_disableoutput();
+	armed = false;
+	tripped = cause;
+}
+
+void protection_onwatchdog(uint16_t raw) {
+	if (!armed)
+		return;
+	protection_trip(raw >= ocpraw ? OPMODE_OCP : OPMODE_OPP);
+}
+
+void protection_checkscan(uint16_t voltraw, bool highgain) {
+	if (!armed)
+		return;
+	if (voltraw >= lvcraw[highgain]) {
+		lvcscans = 0;
+		return;
+	}
+	if (++lvcscans >= PROTECTION_LVCSCANS)
+		protection_trip(OPMODE_LVC);
+}
+
+// the watchdog trips on counts above the threshold so the top count
+// can't be used, anything past that isn't measurable on the shunt
+uint16_t protection_maxamps(void) {
+	return calibration_apply(CALIBRATION_SHUNT,
+			PROTECTION_MAXSHUNTRAW << CALIBRATION_RAWSHIFT);
+}
+
+static inline uint16_t protection_raw(calibration_index which,
+		uint16_t value) {
+	return calibration_unapply(which, value) >> CALIBRATION_RAWSHIFT;
+}
+
+static inline uint16_t protection_shuntraw(uint16_t value) {
+	uint16_t raw = protection_raw(CALIBRATION_SHUNT, value);
+	return raw > PROTECTION_MAXSHUNTRAW ? PROTECTION_MAXSHUNTRAW : raw;
+}
+
+// works the thresholds out again from the settings and the last reading,
+// power is turned into a current limit for the voltage right now
+void protection_update(void) {
+	uint16_t limit = setpoint_divide(opp, volts);
+	uint16_t newlvc = protection_raw(CALIBRATION_VIN, lvc);
+	uint16_t newlvchighgain = protection_raw(CALIBRATION_VINHIGHGAIN, lvc);
+	uint16_t newocp = protection_shuntraw(ocp);
+
+	// a power limit at low volts can ask for more than the shunt reads,
+	// keep the threshold somewhere the watchdog can still get past
+	if (limit > ocp)
+		limit = ocp;
+	limit = protection_shuntraw(limit);
+
+	// a half written threshold could trip the isr
+	disableInterrupts();
+	lvcraw[0] = newlvc;
+	lvcraw[1] = newlvchighgain;
+	ocpraw = newocp;
+	ADC_HTRH = limit >> 2;
+	ADC_HTRL = limit & 0x3;
+	enableInterrupts();
+}
+
+void protection_arm(void) {
+	protection_update();
+	ADC_LTRH = 0;
+	ADC_LTRL = 0;
+
+	disableInterrupts();
+	ADC_AWSRL = 0;
+	ADC_AWSRH = 0;
+	ADC_CSR &= ~ADC_CSR_AWD;
+	ADC_AWCRL |= 1 << ADC_SHUNT;
+	ADC_CSR |= ADC_CSR_AWDIE;
+	tripped = OPMODE_ON;
+	lvcscans = 0;
+	armed = true;
+	enableInterrupts();
+
+	load_enableoutput();
+}
+
+void protection_disarm(void) {
+	disableInterrupts();
+	armed = false;
+	ADC_CSR &= ~ADC_CSR_AWDIE;
+	ADC_AWCRL &= ~(1 << ADC_SHUNT);
+	enableInterrupts();
+}
+
+operationmode protection_tripped(void) {
+	return tripped;
+}
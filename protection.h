@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "state.h"
+
+// trips that can't wait for the main loop, the adc analog watchdog looks
+// after the shunt and every scan of the voltage channel is checked in the
+// adc isr. trips take the pwm output away from the timer there and then
+
+// scans in a row under the lvc threshold before it trips
+#define PROTECTION_LVCSCANS 4
+// highest shunt count a threshold can sit at, the watchdog only fires
+// on counts above it
+#define PROTECTION_MAXSHUNTRAW 1022
+
+void protection_arm(void);
+void protection_disarm(void);
+void protection_update(void);
+operationmode protection_tripped(void);
+// in mA, the most the shunt can tell apart with the current calibration
+uint16_t protection_maxamps(void);
+
+// from the adc isr
+void protection_onwatchdog(uint16_t shuntraw);
+void protection_checkscan(uint16_t voltraw, bool highgain);
@@ -1,75 +1,928 @@
+#include <string.h>
+
 #include "protocol.h"
 #include "uart.h"
 #include "state.h"
 #include "util.h"
+#include "bcd.h"
+#include "timer.h"
+#include "datalog.h"
+#include "adc.h"
+#include "calibration.h"
+#include "transient.h"
+#include "ir.h"
+#include "sequence.h"
+#include "feedforward.h"
+#include "stats.h"
+#include "thermal.h"
+#include "eeprom.h"
+#include "perf.h"
+#include "protection.h"
+
+// big enough for the longest ascii state line, every field and the mode
+#define FRAMESIZE 112
+
+#define TOKENSIZE 8
+#define MAXTOKENS 8
+
+// a line is split into comma separated tokens as it comes in, the first
+// one is the command and the rest are its arguments
+typedef struct {
+	char text[TOKENSIZE + 1];
+	uint16_t value;
+	bool isnumber;
+} token;
+
+static token tokens[MAXTOKENS];
+static uint8_t ntokens = 0;
+static uint8_t tokenlen = 0;
+static bool linetoolong = false;
+static bool binarymode = false;
+
+// with a unit id lines have to start with @<id> or @* for all units, and
+// state only goes out when it's polled. 0 is a unit on its own
+static uint8_t unitid = 0;
+// the command is the token after the address if there is one
+static uint8_t commandtoken = 0;
+
+// frames are built up here so they can be queued in one go
+static char frame[FRAMESIZE];
+static uint8_t framelen = 0;
+
+static bool statepending = false;
+static uint16_t droppedframes = 0;
+
+// log dump in progress, states are held back until it's done
+static bool dumping = false;
+static uint16_t dumpindex;
+static uint16_t dumpcount;
+static uint8_t dumpcrc;
 
-static char command[16];
+// a reply of several lines goes out a line at a time from the telemetry
+// task as the fifo has room, each line is built into the frame by the
+// function that's listing. it returns false once there are no more
+typedef bool (*protocol_listfunc)(uint8_t line);
+static protocol_listfunc listing = 0;
+static uint8_t listingline;
+
+// stream every nth reading or, if the period isn't 0, every period ms
+static uint16_t streamfields = PROTOCOL_FIELDS_DEFAULT;
+static uint16_t streamevery = 1;
+static uint16_t streamperiod = 0;
+
+// anything past the end is dropped rather than written over whatever's
+// after the frame
+static inline void frame_putch(char ch) {
+	if (framelen < FRAMESIZE)
+		frame[framelen++] = ch;
+}
+
+static void frame_puts(char* str) {
+	while (*str != '\0')
+		frame_putch(*str++);
+}
 
 static inline void sep(void) {
-	uart_puts(",");
+	frame_putch(',');
 }
 
 static void splitandprintvalue(uint16_t value) {
 	int i;
-	uint16_t splittmp[6];
-	split(value, splittmp, 6);
+	uint8_t splittmp[6];
+	bcd_split(value, splittmp, 6);
 	for (i = 0; i < 6; i++) {
-		uart_putch(splittmp[i] + 0x30);
+		frame_putch(splittmp[i] + 0x30);
 	}
 }
 
+// for replies, blocks until the whole value is queued
+static void protocol_printvalue(uint16_t value) {
+	uint8_t i;
+	framelen = 0;
+	splitandprintvalue(value);
+	for (i = 0; i < framelen; i++)
+		uart_putch(frame[i]);
+}
+
+#ifdef PERF
+// into the frame, without leading zeros
+static void frame_putlong(uint32_t value) {
+	char digits[11];
+	uint8_t pos = sizeof(digits) - 1;
+
+	digits[pos] = '\0';
+	do {
+		digits[--pos] = (value % 10) + '0';
+		value /= 10;
+	} while (value != 0);
+	frame_puts(&digits[pos]);
+}
+#endif
+
 void protocol_onbooted(void) {
-	uart_puts("BOOTED");
+	if (unitid == 0)
+		uart_puts("BOOTED");
 }
 
-void protocol_sendstate(void) {
+static inline void protocol_packvalue(uint16_t value) {
+	frame_putch((char) (value & 0xff));
+	frame_putch((char) ((value >> 8) & 0xff));
+}
+
+static void protocol_packlong(uint32_t value) {
+	protocol_packvalue((uint16_t) value);
+	protocol_packvalue((uint16_t) (value >> 16));
+}
+
+// from the snapshot so everything in a frame is from the same update, the
+// settings only change in the main loop
+static uint16_t protocol_fieldvalue(state_snapshot* snapshot,
+		protocol_field field) {
+	switch (field) {
+	case PROTOCOL_FIELD_VOLTS:
+		return snapshot->volts;
+	case PROTOCOL_FIELD_AMPS:
+		return snapshot->amps;
+	case PROTOCOL_FIELD_WATTS:
+		return snapshot->watts;
+	case PROTOCOL_FIELD_TARGETAMPS:
+		return targetamps;
+	case PROTOCOL_FIELD_LVC:
+		return lvc;
+	case PROTOCOL_FIELD_LOADDUTY:
+		return snapshot->loadduty;
+	case PROTOCOL_FIELD_TIME:
+		return (uint16_t) snapshot->time;
+	case PROTOCOL_FIELD_TIMEHIGH:
+		return (uint16_t) (snapshot->time >> 16);
+	case PROTOCOL_FIELD_MILLIS:
+		return (uint16_t) snapshot->millis;
+	case PROTOCOL_FIELD_MILLISHIGH:
+		return (uint16_t) (snapshot->millis >> 16);
+	case PROTOCOL_FIELD_AMPHOURS:
+		return snapshot->amphours;
+	case PROTOCOL_FIELD_WATTHOURS:
+		return (uint16_t) snapshot->watthours;
+	case PROTOCOL_FIELD_WATTHOURSHIGH:
+		return (uint16_t) (snapshot->watthours >> 16);
+	case PROTOCOL_FIELD_RESISTANCE:
+		return snapshot->resistance;
+	case PROTOCOL_FIELD_END:
+		break;
+	}
+	return 0;
+}
 
-	switch (om) {
+static void protocol_buildstatebinary(state_snapshot* snapshot) {
+	static uint8_t framesequence = 0;
+	protocol_field field;
+
+	frame_putch(PROTOCOL_SYNC);
+	frame_putch(PROTOCOL_FRAME_STATE);
+	frame_putch(framesequence++);
+	frame_putch((char) snapshot->om);
+	protocol_packvalue(streamfields);
+	for (field = 0; field < PROTOCOL_FIELD_END; field++) {
+		if (streamfields & (1 << field))
+			protocol_packvalue(protocol_fieldvalue(snapshot, field));
+	}
+	frame_putch(crc8(0, (uint8_t*) &frame[1], framelen - 1));
+}
+
+static void protocol_buildstateascii(state_snapshot* snapshot) {
+	protocol_field field;
+
+	switch (snapshot->om) {
 	case OPMODE_OFF:
-		uart_puts("off");
+		frame_puts("off");
 		break;
 	case OPMODE_SET:
-		uart_puts("set");
+		frame_puts("set");
 		break;
 	case OPMODE_ON:
-		uart_puts("on");
+		frame_puts("on");
 		break;
 	case OPMODE_LVC:
-		uart_puts("lvc");
+		frame_puts("lvc");
+		break;
+	case OPMODE_OCP:
+		frame_puts("ocp");
+		break;
+	case OPMODE_OPP:
+		frame_puts("opp");
+		break;
+	case OPMODE_TRANSIENT:
+		frame_puts("tran");
 		break;
 	}
-	sep();
 
-	// volts
-	splitandprintvalue(volts);
-	sep();
+	for (field = 0; field < PROTOCOL_FIELD_END; field++) {
+		if (streamfields & (1 << field)) {
+			sep();
+			splitandprintvalue(protocol_fieldvalue(snapshot, field));
+		}
+	}
 
-	// amps
-	splitandprintvalue(amps);
-	sep();
+	frame_puts("\r\n");
+}
 
-	// watts
-	splitandprintvalue(watts);
-	sep();
+// queues the current state if there is room for the whole frame, if there
+// isn't the state stays pending and gets rebuilt on the next try so the
+// host always gets the latest values
+static void protocol_trysendstate(void) {
+	state_snapshot snapshot;
 
-	// target amps
-	splitandprintvalue(targetamps);
-	sep();
+	if (dumping || listing != 0)
+		return;
 
-	// lvc
-	splitandprintvalue(lvc);
+	state_getsnapshot(&snapshot);
+	framelen = 0;
+	if (binarymode)
+		protocol_buildstatebinary(&snapshot);
+	else
+		protocol_buildstateascii(&snapshot);
 
-	//
-	sep();
-	splitandprintvalue(loadduty);
+	if (uart_write(frame, framelen))
+		statepending = false;
+}
+
+static void protocol_queuestate(void) {
+	// the last state never made it out and is replaced by this one
+	if (statepending)
+		droppedframes++;
+	statepending = true;
+	protocol_trysendstate();
+}
+
+// on a bus nothing goes out without being asked for
+void protocol_sendstate(void) {
+	if (unitid != 0)
+		return;
+	perf_enter(PERF_SENDSTATE);
+	protocol_queuestate();
+	perf_exit(PERF_SENDSTATE);
+}
+
+// decides which readings get streamed
+void protocol_onreadings(void) {
+	static uint16_t readings = 0;
+	static uint32_t lastsent = 0;
+	uint32_t now;
+
+	if (streamperiod != 0) {
+		now = timer_millis();
+		if (now - lastsent < streamperiod)
+			return;
+		lastsent = now;
+	} else {
+		readings++;
+		if (readings < streamevery)
+			return;
+		readings = 0;
+	}
+
+	protocol_sendstate();
+}
+
+// the header goes out like any other reply, the records follow as there
+// is room for them
+static void protocol_startdump(void) {
+	uint8_t i;
+
+	dumpindex = 0;
+	dumpcount = datalog_count();
+
+	framelen = 0;
+	frame_putch(PROTOCOL_SYNC);
+	frame_putch(PROTOCOL_FRAME_LOG);
+	protocol_packvalue(dumpcount);
+	dumpcrc = crc8(0, (uint8_t*) &frame[1], framelen - 1);
+	for (i = 0; i < framelen; i++)
+		uart_putch(frame[i]);
+	dumping = true;
+}
+
+// keeps the fifo topped up with records until the whole log has gone out
+static void protocol_continuedump(void) {
+	datalog_record record;
+
+	while (dumpindex < dumpcount && uart_txfree() >= sizeof(record)) {
+		datalog_getrecord(dumpindex++, &record);
+		framelen = 0;
+		protocol_packlong(record.time);
+		protocol_packvalue(record.volts);
+		protocol_packvalue(record.amps);
+		dumpcrc = crc8(dumpcrc, (uint8_t*) frame, framelen);
+		uart_write(frame, framelen);
+	}
+
+	if (dumpindex == dumpcount && uart_txfree() > 0) {
+		uart_putch(dumpcrc);
+		dumping = false;
+	}
+}
+
+static bool protocol_startlisting(protocol_listfunc func) {
+	if (listing != 0)
+		return false;
+	listing = func;
+	listingline = 0;
+	return true;
+}
+
+// a line that doesn't fit yet is built again next time
+static void protocol_continuelisting(void) {
+	while (listing != 0) {
+		framelen = 0;
+		if (!listing(listingline)) {
+			listing = 0;
+			return;
+		}
+		if (!uart_write(frame, framelen))
+			return;
+		listingline++;
+	}
+}
 
-	uart_puts("\r\n");
+void protocol_checkpending(void) {
+	if (dumping)
+		protocol_continuedump();
+	if (listing != 0)
+		protocol_continuelisting();
+	if (statepending && uart_txfree() >= FRAMESIZE)
+		protocol_trysendstate();
 }
 
+static const char* const commandnames[] = { //
+		[PROTOCOL_COMMAND_ON] = "ON", //
+				[PROTOCOL_COMMAND_OFF] = "OFF", //
+				[PROTOCOL_COMMAND_SET] = "SET", //
+				[PROTOCOL_COMMAND_BINARY] = "BIN", //
+				[PROTOCOL_COMMAND_ASCII] = "ASCII", //
+				[PROTOCOL_COMMAND_DROPPED] = "DROP", //
+				[PROTOCOL_COMMAND_RATE] = "RATE", //
+				[PROTOCOL_COMMAND_FIELDS] = "FIELDS", //
+				[PROTOCOL_COMMAND_LOG] = "LOG", //
+				[PROTOCOL_COMMAND_DUMP] = "DUMP", //
+				[PROTOCOL_COMMAND_PERF] = "PERF", //
+				[PROTOCOL_COMMAND_MODE] = "MODE", //
+				[PROTOCOL_COMMAND_OVERSAMPLING] = "OSR", //
+				[PROTOCOL_COMMAND_CALIBRATE] = "CAL", //
+				[PROTOCOL_COMMAND_TRANSIENT] = "TRAN", //
+				[PROTOCOL_COMMAND_IR] = "IR", //
+				[PROTOCOL_COMMAND_SEQUENCE] = "SEQ", //
+				[PROTOCOL_COMMAND_FEEDFORWARD] = "FF", //
+				[PROTOCOL_COMMAND_STATS] = "STATS", //
+				[PROTOCOL_COMMAND_TEMPERATURE] = "TEMP", //
+				[PROTOCOL_COMMAND_ADDRESS] = "ADDR", //
+				[PROTOCOL_COMMAND_POLL] = "POLL" //
+		};
+
+#define NUMCOMMANDS (sizeof(commandnames) / sizeof(commandnames[0]))
+
 static void protocol_commanderror() {
 	uart_puts("!\n");
 }
 
+static inline uint8_t protocol_numargs(void) {
+	return ntokens - 1 - commandtoken;
+}
+
+static inline char* protocol_argtext(uint8_t which) {
+	return tokens[commandtoken + which + 1].text;
+}
+
+static bool protocol_argnumber(uint8_t which, uint16_t* value) {
+	token* t = &tokens[commandtoken + which + 1];
+	if (which >= protocol_numargs() || !t->isnumber)
+		return false;
+	*value = t->value;
+	return true;
+}
+
+static bool protocol_set(void) {
+	uint16_t value;
+	char* what;
+
+	if (protocol_numargs() != 2 || !protocol_argnumber(1, &value))
+		return false;
+
+	what = protocol_argtext(0);
+	if (strcmp(what, "A") == 0)
+		targetamps = value;
+	else if (strcmp(what, "R") == 0)
+		targetohms = value;
+	else if (strcmp(what, "P") == 0)
+		targetwatts = value;
+	else if (strcmp(what, "LVC") == 0)
+		lvc = value;
+	else if (strcmp(what, "OCP") == 0) {
+		if (value > protection_maxamps())
+			return false;
+		ocp = value;
+	}
+	else if (strcmp(what, "OPP") == 0)
+		opp = value;
+	else
+		return false;
+
+	return true;
+}
+
+// MODE,CC|CR|CP picks what the load regulates to
+static bool protocol_mode(void) {
+	static const char* const modenames[] = { //
+			[REGMODE_CC] = "CC", //
+					[REGMODE_CR] = "CR", //
+					[REGMODE_CP] = "CP" //
+			};
+	regulationmode mode;
+
+	if (protocol_numargs() != 1)
+		return false;
+
+	for (mode = 0; mode < REGMODE_END; mode++) {
+		if (strcmp(protocol_argtext(0), modenames[mode]) == 0) {
+			rm = mode;
+			return true;
+		}
+	}
+	return false;
+}
+
+// OSR,<n> averages 4^n conversions per reading, OSR on its own replies
+// with the current n
+static bool protocol_oversampling(void) {
+	uint16_t value;
+
+	if (protocol_numargs() == 0) {
+		protocol_printvalue(adc_getoversampling());
+		uart_puts("\n");
+		return true;
+	}
+
+	if (protocol_numargs() != 1 || !protocol_argnumber(0, &value)
+			|| value > 0xff || !adc_setoversampling(value))
+		return false;
+
+	uart_puts("osr\n");
+	return true;
+}
+
+// CAL,V|VH|A,1|2,<mV or mA> takes a calibration point against a reference
+// reading, the second point sets the new calibration. CAL,SAVE puts it in
+// the eeprom and CAL,RESET goes back to the defaults
+static bool protocol_calibrate(void) {
+	static const char* const channelnames[] = { //
+			[CALIBRATION_VIN] = "V", //
+					[CALIBRATION_VINHIGHGAIN] = "VH", //
+					[CALIBRATION_SHUNT] = "A" //
+			};
+	calibration_index which;
+	uint16_t point, value, raw;
+
+	if (protocol_numargs() == 1) {
+		if (strcmp(protocol_argtext(0), "SAVE") == 0)
+			calibration_save();
+		else if (strcmp(protocol_argtext(0), "RESET") == 0)
+			calibration_reset();
+		else
+			return false;
+		return true;
+	}
+
+	if (protocol_numargs() != 3 || !protocol_argnumber(1, &point)
+			|| !protocol_argnumber(2, &value))
+		return false;
+
+	for (which = 0; which < CALIBRATION_END; which++) {
+		if (strcmp(protocol_argtext(0), channelnames[which]) == 0)
+			break;
+	}
+
+	// the range for the voltage channel has to be the one in use
+	if (which == CALIBRATION_END || !adc_getraw(which, &raw))
+		return false;
+
+	switch (point) {
+	case 1:
+		calibration_firstpoint(which, raw, value);
+		return true;
+	case 2:
+		return calibration_secondpoint(which, raw, value);
+	default:
+		return false;
+	}
+}
+
+// TRAN on its own turns the load on switching between two currents,
+// TRAN,A,<low mA>,<high mA> sets them and TRAN,MS,<period>,<high> how
+// long a period is and how much of it is at the high current
+static bool protocol_transient(void) {
+	uint16_t first, second;
+	char* what;
+
+	if (protocol_numargs() == 0)
+		return state_changeopmode(OPMODE_TRANSIENT);
+
+	if (protocol_numargs() != 3 || !protocol_argnumber(1, &first)
+			|| !protocol_argnumber(2, &second))
+		return false;
+
+	what = protocol_argtext(0);
+	if (strcmp(what, "A") == 0)
+		return transient_setlevels(first, second);
+	else if (strcmp(what, "MS") == 0)
+		return transient_settiming(first, second);
+	return false;
+}
+
+// IR,<mA>[,<ms>] pulses the load up to mA from the constant current
+// setpoint for ms and measures the internal resistance, IR on its own
+// replies with the last result in mOhm
+static bool protocol_ir(void) {
+	uint16_t value, ms = IR_DEFAULTPULSEMS;
+
+	if (protocol_numargs() == 0) {
+		if (!ir_result(&value))
+			return false;
+		protocol_printvalue(value);
+		uart_puts("\n");
+		return true;
+	}
+
+	if (protocol_numargs() > 2 || !protocol_argnumber(0, &value)
+			|| (protocol_numargs() == 2 && !protocol_argnumber(1, &ms))
+			|| !ir_start(value, ms))
+		return false;
+
+	uart_puts("ir\n");
+	return true;
+}
+
+// index of text in names, count if it isn't there
+static uint8_t protocol_lookup(char* text, const char* const * names,
+		uint8_t count) {
+	uint8_t i;
+	for (i = 0; i < count; i++) {
+		if (strcmp(text, names[i]) == 0)
+			break;
+	}
+	return i;
+}
+
+// one line per step that has run, its index, how it ended, how long it
+// ran and the readings it ended on, then how the sequence is doing
+static bool protocol_sequenceline(uint8_t line) {
+	static const char endednames[] = { //
+			[SEQUENCE_ENDED_TIME] = 'T', //
+					[SEQUENCE_ENDED_EXIT] = 'X', //
+					[SEQUENCE_ENDED_ABORTED] = 'A' //
+			};
+	static const char* const statusnames[] = { //
+			[SEQUENCE_IDLE] = "idle", //
+					[SEQUENCE_RUNNING] = "run", //
+					[SEQUENCE_DONE] = "done", //
+					[SEQUENCE_ABORTED] = "abort" //
+			};
+	sequence_result result;
+
+	if (line > sequence_results())
+		return false;
+
+	if (line == sequence_results())
+		frame_puts((char*) statusnames[sequence_getstatus()]);
+	else {
+		sequence_getresult(line, &result);
+		splitandprintvalue(line);
+		sep();
+		frame_putch(endednames[result.ended]);
+		sep();
+		splitandprintvalue(result.seconds);
+		sep();
+		splitandprintvalue(result.volts);
+		sep();
+		splitandprintvalue(result.amps);
+		sep();
+		splitandprintvalue(result.amphours);
+	}
+	frame_puts("\n");
+	return true;
+}
+
+// SEQ,<n>,<mode>,<setpoint>,<s>[,<exit>,<limit>] sets step n, mode is one
+// of REST, CC, CR or CP and exit one of VLT, VGT, ALT, AGT or AHGT. steps
+// have to be added in order. SEQ,RUN and SEQ,STOP start and stop it,
+// SEQ,SAVE keeps the steps in the eeprom, SEQ,CLEAR empties the table and
+// SEQ on its own sends the results
+static bool protocol_sequence(void) {
+	static const char* const modenames[] = { //
+			[SEQUENCE_REST] = "REST", //
+					[SEQUENCE_CC] = "CC", //
+					[SEQUENCE_CR] = "CR", //
+					[SEQUENCE_CP] = "CP" //
+			};
+	static const char* const exitnames[] = { //
+			[SEQUENCE_EXIT_NONE] = "", //
+					[SEQUENCE_EXIT_VBELOW] = "VLT", //
+					[SEQUENCE_EXIT_VABOVE] = "VGT", //
+					[SEQUENCE_EXIT_ABELOW] = "ALT", //
+					[SEQUENCE_EXIT_AABOVE] = "AGT", //
+					[SEQUENCE_EXIT_AHABOVE] = "AHGT" //
+			};
+	sequence_step step;
+	uint16_t index;
+	char* what;
+	bool ok = true;
+
+	if (protocol_numargs() == 0)
+		return protocol_startlisting(protocol_sequenceline);
+
+	if (protocol_numargs() == 1) {
+		what = protocol_argtext(0);
+		if (strcmp(what, "RUN") == 0)
+			ok = sequence_start();
+		else if (strcmp(what, "STOP") == 0)
+			sequence_stop();
+		else if (strcmp(what, "SAVE") == 0)
+			sequence_save();
+		else if (strcmp(what, "CLEAR") == 0)
+			sequence_clear();
+		else
+			ok = false;
+	} else {
+		step.exit = SEQUENCE_EXIT_NONE;
+		step.limit = 0;
+		if ((protocol_numargs() != 4 && protocol_numargs() != 6)
+				|| !protocol_argnumber(0, &index)
+				|| !protocol_argnumber(2, &step.setpoint)
+				|| !protocol_argnumber(3, &step.seconds))
+			return false;
+		step.mode = protocol_lookup(protocol_argtext(1), modenames,
+				SEQUENCE_MODEEND);
+		if (protocol_numargs() == 6) {
+			step.exit = protocol_lookup(protocol_argtext(4), exitnames,
+					SEQUENCE_EXIT_END);
+			if (step.exit == SEQUENCE_EXIT_NONE
+					|| !protocol_argnumber(5, &step.limit))
+				return false;
+		}
+		ok = index <= 0xff && sequence_setstep(index, &step);
+	}
+
+	if (ok)
+		uart_puts("seq\n");
+	return ok;
+}
+
+// the nth learned point, counting from the normal range's first bin
+static bool protocol_feedforwardline(uint8_t line) {
+	feedforward_point point;
+	uint8_t range, bin;
+
+	for (range = 0; range < 2; range++) {
+		for (bin = 0; bin < FEEDFORWARD_BINS; bin++) {
+			if (!feedforward_getpoint(range, bin, &point))
+				continue;
+			if (line-- != 0)
+				continue;
+			splitandprintvalue(range);
+			sep();
+			splitandprintvalue(point.amps);
+			sep();
+			splitandprintvalue(point.duty);
+			frame_puts("\n");
+			return true;
+		}
+	}
+	return false;
+}
+
+// FF sends the learned points as range, mA and duty, 1 is the high gain
+// range. FF,SWEEP,<mA> learns the map up to mA while the load is on and
+// FF,CLEAR forgets it
+static bool protocol_feedforward(void) {
+	uint16_t value;
+	char* what;
+
+	if (protocol_numargs() == 0)
+		return protocol_startlisting(protocol_feedforwardline);
+
+	what = protocol_argtext(0);
+	if (protocol_numargs() == 1 && strcmp(what, "CLEAR") == 0)
+		feedforward_clear();
+	else if (protocol_numargs() == 2 && strcmp(what, "SWEEP") == 0) {
+		if (!protocol_argnumber(1, &value) || !feedforward_sweep(value))
+			return false;
+	} else
+		return false;
+
+	uart_puts("ff\n");
+	return true;
+}
+
+// the whole reply is the one line
+static bool protocol_statsline(uint8_t line) {
+	stats_summary summary;
+	stats_channel channel;
+	uint16_t windows;
+
+	if (line != 0)
+		return false;
+
+	for (channel = 0; channel < STATS_END; channel++) {
+		windows = stats_get(channel, &summary);
+		if (channel == 0)
+			splitandprintvalue(windows);
+		sep();
+		splitandprintvalue(summary.min);
+		sep();
+		splitandprintvalue(summary.max);
+		sep();
+		splitandprintvalue(summary.mean);
+		sep();
+		splitandprintvalue(summary.max - summary.min);
+	}
+	frame_puts("\n");
+	return true;
+}
+
+// STATS replies with how many windows there have been and the min, max,
+// mean and peak to peak of the volts and then the amps over the last one.
+// STATS,<n> makes the windows 2^n readings
+static bool protocol_stats(void) {
+	uint16_t value;
+
+	if (protocol_numargs() == 1) {
+		if (!protocol_argnumber(0, &value) || value > STATS_MAXWINDOWSHIFT
+				|| !stats_setwindow(value))
+			return false;
+		uart_puts("stats\n");
+		return true;
+	}
+
+	if (protocol_numargs() != 0)
+		return false;
+	return protocol_startlisting(protocol_statsline);
+}
+
+// TEMP replies with the modelled temperature in hundredths of a degree and
+// how many ms out of every THERMAL_FANPERIOD the fan is on for.
+// TEMP,FAN,<start>,<full> sets where the fan comes on and where it's full
+static bool protocol_temperature(void) {
+	uint16_t start, full;
+
+	if (protocol_numargs() == 0) {
+		protocol_printvalue(thermal_temperature());
+		uart_putch(',');
+		protocol_printvalue(thermal_fanduty());
+		uart_puts("\n");
+		return true;
+	}
+
+	if (protocol_numargs() != 3 || strcmp(protocol_argtext(0), "FAN") != 0
+			|| !protocol_argnumber(1, &start) || !protocol_argnumber(2, &full)
+			|| !thermal_setfancurve(start, full))
+		return false;
+
+	uart_puts("temp\n");
+	return true;
+}
+
+// ADDR,<id> puts the unit on a bus as id and keeps it in the eeprom, 0
+// takes it off again. ADDR on its own replies with the id
+static bool protocol_address(void) {
+	uint16_t value;
+	uint8_t id;
+
+	if (protocol_numargs() == 0) {
+		protocol_printvalue(unitid);
+		uart_puts("\n");
+		return true;
+	}
+
+	if (protocol_numargs() != 1 || !protocol_argnumber(0, &value)
+			|| value > 0xff)
+		return false;
+
+	id = (uint8_t) value;
+	eeprom_writeblocking(EEPROM_UNITID, &id, 1);
+	// the reply still goes out the old way
+	uart_puts("addr\n");
+	unitid = id;
+	uart_setbus(unitid != 0);
+	return true;
+}
+
+// RATE,N,<n> streams every nth reading, RATE,MS,<ms> at most every ms
+static bool protocol_rate(void) {
+	uint16_t value;
+	char* what;
+
+	if (protocol_numargs() != 2 || !protocol_argnumber(1, &value))
+		return false;
+
+	what = protocol_argtext(0);
+	if (strcmp(what, "N") == 0 && value != 0) {
+		streamevery = value;
+		streamperiod = 0;
+	} else if (strcmp(what, "MS") == 0 && value != 0)
+		streamperiod = value;
+	else
+		return false;
+
+	return true;
+}
+
+static bool protocol_fields(void) {
+	uint16_t value;
+
+	if (protocol_numargs() != 1 || !protocol_argnumber(0, &value)
+			|| value >= (1 << PROTOCOL_FIELD_END))
+		return false;
+
+	streamfields = value;
+	return true;
+}
+
+// LOG,RATE,<s> records every s seconds while on, 0 stops logging,
+// LOG,RAM and LOG,EEPROM pick where the records go, LOG,CLEAR empties it
+static bool protocol_log(void) {
+	uint16_t value;
+	char* what;
+
+	if (protocol_numargs() == 0)
+		return false;
+
+	what = protocol_argtext(0);
+	if (strcmp(what, "RATE") == 0) {
+		if (protocol_numargs() != 2 || !protocol_argnumber(1, &value))
+			return false;
+		datalog_setrate(value);
+		return true;
+	}
+
+	if (protocol_numargs() != 1)
+		return false;
+
+	if (strcmp(what, "RAM") == 0)
+		datalog_setstorage(DATALOG_RAM);
+	else if (strcmp(what, "EEPROM") == 0)
+		datalog_setstorage(DATALOG_EEPROM);
+	else if (strcmp(what, "CLEAR") == 0)
+		datalog_clear();
+	else
+		return false;
+
+	return true;
+}
+
+#ifdef PERF
+// name, calls and the min, max and total cycles for a timed place
+static bool protocol_perfline(uint8_t line) {
+	perf_stats stats;
+
+	if (line >= PERF_END)
+		return false;
+	perf_get((perf_point) line, &stats);
+	frame_puts((char*) perf_name((perf_point) line));
+	sep();
+	frame_putlong(stats.calls);
+	sep();
+	frame_putlong(stats.min);
+	sep();
+	frame_putlong(stats.max);
+	sep();
+	frame_putlong(stats.total);
+	frame_puts("\n");
+	return true;
+}
+
+// the lines go out from the telemetry task, false if another listing is
+// still going
+bool protocol_sendperf(void) {
+	return protocol_startlisting(protocol_perfline);
+}
+#endif
+
+// PERF sends the report, PERF,RESET starts over
+static bool protocol_perf(void) {
+#ifdef PERF
+	if (protocol_numargs() == 1 && strcmp(protocol_argtext(0), "RESET") == 0) {
+		perf_reset();
+		uart_puts("perf\n");
+		return true;
+	}
+
+	if (protocol_numargs() != 0)
+		return false;
+
+	return protocol_sendperf();
+#else
+	return false;
+#endif
+}
+
 static void protocol_handlecommand(protocol_command cmd) {
 	switch (cmd) {
 	case PROTOCOL_COMMAND_ON:
@@ -85,7 +938,99 @@ static void protocol_handlecommand(protocol_command cmd) {
 			protocol_commanderror();
 		break;
 	case PROTOCOL_COMMAND_SET:
-		uart_puts("set\n");
+		if (protocol_set())
+			uart_puts("set\n");
+		else
+			protocol_commanderror();
+		break;
+	case PROTOCOL_COMMAND_BINARY:
+		binarymode = true;
+		uart_puts("bin\n");
+		break;
+	case PROTOCOL_COMMAND_ASCII:
+		binarymode = false;
+		uart_puts("ascii\n");
+		break;
+	case PROTOCOL_COMMAND_DROPPED:
+		protocol_printvalue(droppedframes);
+		uart_puts("\n");
+		break;
+	case PROTOCOL_COMMAND_RATE:
+		if (protocol_rate())
+			uart_puts("rate\n");
+		else
+			protocol_commanderror();
+		break;
+	case PROTOCOL_COMMAND_FIELDS:
+		if (protocol_fields())
+			uart_puts("fields\n");
+		else
+			protocol_commanderror();
+		break;
+	case PROTOCOL_COMMAND_LOG:
+		if (protocol_log())
+			uart_puts("log\n");
+		else
+			protocol_commanderror();
+		break;
+	case PROTOCOL_COMMAND_DUMP:
+		if (dumping)
+			protocol_commanderror();
+		else
+			protocol_startdump();
+		break;
+	case PROTOCOL_COMMAND_PERF:
+		if (!protocol_perf())
+			protocol_commanderror();
+		break;
+	case PROTOCOL_COMMAND_MODE:
+		if (protocol_mode())
+			uart_puts("mode\n");
+		else
+			protocol_commanderror();
+		break;
+	case PROTOCOL_COMMAND_OVERSAMPLING:
+		if (!protocol_oversampling())
+			protocol_commanderror();
+		break;
+	case PROTOCOL_COMMAND_CALIBRATE:
+		if (protocol_calibrate())
+			uart_puts("cal\n");
+		else
+			protocol_commanderror();
+		break;
+	case PROTOCOL_COMMAND_TRANSIENT:
+		if (protocol_transient())
+			uart_puts("tran\n");
+		else
+			protocol_commanderror();
+		break;
+	case PROTOCOL_COMMAND_IR:
+		if (!protocol_ir())
+			protocol_commanderror();
+		break;
+	case PROTOCOL_COMMAND_SEQUENCE:
+		if (!protocol_sequence())
+			protocol_commanderror();
+		break;
+	case PROTOCOL_COMMAND_FEEDFORWARD:
+		if (!protocol_feedforward())
+			protocol_commanderror();
+		break;
+	case PROTOCOL_COMMAND_STATS:
+		if (!protocol_stats())
+			protocol_commanderror();
+		break;
+	case PROTOCOL_COMMAND_TEMPERATURE:
+		if (!protocol_temperature())
+			protocol_commanderror();
+		break;
+	case PROTOCOL_COMMAND_ADDRESS:
+		if (!protocol_address())
+			protocol_commanderror();
+		break;
+	case PROTOCOL_COMMAND_POLL:
+		protocol_queuestate();
 		break;
 	case PROTOCOL_COMMAND_INVALID:
 		uart_puts("?\n");
@@ -94,63 +1039,143 @@ static void protocol_handlecommand(protocol_command cmd) {
 }
 
 static protocol_command protocol_parsecommand() {
-	switch (command[0]) {
-	case 'O':
-		switch (command[1]) {
-		case 'N':
-			if (command[2] == '\0')
-				return PROTOCOL_COMMAND_ON;
-			break;
-		case 'F':
-			if ((command[2] == 'F') && (command[3] == '\0'))
-				return PROTOCOL_COMMAND_OFF;
-			break;
-		}
-		break;
-	case 'S':
-		if ((command[1] == 'E') && (command[2] == 'T') && (command[3] == '\0'))
-			return PROTOCOL_COMMAND_SET;
-		break;
+	uint8_t i;
+
+	if (linetoolong || ntokens <= commandtoken)
+		return PROTOCOL_COMMAND_INVALID;
+
+	for (i = 0; i < NUMCOMMANDS; i++) {
+		if (commandnames[i] != 0
+				&& strcmp(tokens[commandtoken].text, commandnames[i]) == 0)
+			return (protocol_command) i;
 	}
 
 	return PROTOCOL_COMMAND_INVALID;
+}
+
+// @<id> in the first token, false if it isn't one
+static bool protocol_parseaddress(char* text, uint8_t* address) {
+	uint16_t value = 0;
 
+	if (*text++ != '@' || *text == '\0')
+		return false;
+
+	for (; *text != '\0'; text++) {
+		if (*text < '0' || *text > '9')
+			return false;
+		value = (value * 10) + (*text - '0');
+		if (value > 0xff)
+			return false;
+	}
+	*address = (uint8_t) value;
+	return true;
 }
 
-static bool protocol_readpart() {
-	bool last = false;
-	uint8_t commandpos;
-	bool issep, islineend;
-	for (commandpos = 0; commandpos < (sizeof(command) - 1); commandpos++) {
-		uart_getch(&command[commandpos]);
-		issep = (command[commandpos] == ',');
-		islineend = (command[commandpos] == '\n');
-		if (issep || islineend) {
-			if (islineend)
-				last = true;
-			break;
-		}
+// works out who the line is for first, broadcasts only turn the load on
+// or off and never get a reply so the units don't talk over each other
+static void protocol_handleline(void) {
+	bool broadcast = false;
+	uint8_t address = 0;
+	protocol_command cmd;
+
+	commandtoken = 0;
+	if (!linetoolong && tokens[0].text[0] == '@') {
+		if (strcmp(tokens[0].text, "@*") == 0)
+			broadcast = true;
+		else if (!protocol_parseaddress(tokens[0].text, &address))
+			return;
+		commandtoken = 1;
 	}
-	command[commandpos] = '\0';
 
-	return last;
+	// on a bus there's no telling who a line that's too long was for
+	if (unitid != 0
+			&& (linetoolong || commandtoken == 0
+					|| (!broadcast && address != unitid)))
+		return;
+
+	cmd = protocol_parsecommand();
+	if (broadcast) {
+		if (cmd == PROTOCOL_COMMAND_ON)
+			state_changeopmode(OPMODE_ON);
+		else if (cmd == PROTOCOL_COMMAND_OFF)
+			state_changeopmode(OPMODE_OFF);
+		return;
+	}
+
+	protocol_handlecommand(cmd);
 }
 
-void protocol_checkcommand() {
-	static uint8_t lastsequence = 0;
-	bool last = false;
-	protocol_command cmd;
-	if (sequence != lastsequence) {
+static void protocol_starttoken(void) {
+	token* t = &tokens[ntokens];
+	t->value = 0;
+	t->isnumber = true;
+	tokenlen = 0;
+}
 
-		last = protocol_readpart();
-		cmd = protocol_parsecommand();
-		protocol_handlecommand(cmd);
+static void protocol_endtoken(void) {
+	token* t = &tokens[ntokens];
+	t->text[tokenlen] = '\0';
+	if (tokenlen == 0)
+		t->isnumber = false;
+	ntokens++;
+}
 
-		while (!last) {
-			last = protocol_readpart();
-			uart_puts(command);
-			uart_putch(',');
+static void protocol_addtotoken(char ch) {
+	token* t = &tokens[ntokens];
+	uint8_t digit = ch - '0';
+
+	if (tokenlen == TOKENSIZE) {
+		linetoolong = true;
+		return;
+	}
+	t->text[tokenlen++] = ch;
+
+	if (digit > 9 || t->value > 6553 || (t->value == 6553 && digit > 5))
+		t->isnumber = false;
+	else
+		t->value = (t->value * 10) + digit;
+}
+
+static void protocol_parsebyte(char ch) {
+	switch (ch) {
+	case '\r':
+		break;
+	case '\n':
+		if (!linetoolong)
+			protocol_endtoken();
+		// ignore empty lines
+		if (linetoolong || ntokens > 1 || tokens[0].text[0] != '\0')
+			protocol_handleline();
+		ntokens = 0;
+		linetoolong = false;
+		protocol_starttoken();
+		break;
+	case ',':
+		if (!linetoolong) {
+			protocol_endtoken();
+			if (ntokens == MAXTOKENS)
+				linetoolong = true;
+			else
+				protocol_starttoken();
 		}
-		lastsequence = sequence;
+		break;
+	default:
+		if (!linetoolong)
+			protocol_addtotoken(ch);
+		break;
 	}
 }
+
+// only looks at what has already been received so it never blocks
+void protocol_checkcommand() {
+	uint8_t ch;
+	while (uart_getch(&ch))
+		protocol_parsebyte((char) ch);
+}
+
+void protocol_init(void) {
+	unitid = eeprom_read(EEPROM_UNITID);
+	if (unitid != 0)
+		uart_setbus(true);
+	protocol_starttoken();
+}
@@ -1,12 +1,84 @@
 #pragma once
 
+#include <stdbool.h>
+
 typedef enum {
 	PROTOCOL_COMMAND_INVALID,
 	PROTOCOL_COMMAND_ON,
 	PROTOCOL_COMMAND_OFF,
-	PROTOCOL_COMMAND_SET
+	PROTOCOL_COMMAND_SET,
+	PROTOCOL_COMMAND_BINARY,
+	PROTOCOL_COMMAND_ASCII,
+	PROTOCOL_COMMAND_DROPPED,
+	PROTOCOL_COMMAND_RATE,
+	PROTOCOL_COMMAND_FIELDS,
+	PROTOCOL_COMMAND_LOG,
+	PROTOCOL_COMMAND_DUMP,
+	PROTOCOL_COMMAND_PERF,
+	PROTOCOL_COMMAND_MODE,
+	PROTOCOL_COMMAND_OVERSAMPLING,
+	PROTOCOL_COMMAND_CALIBRATE,
+	PROTOCOL_COMMAND_TRANSIENT,
+	PROTOCOL_COMMAND_IR,
+	PROTOCOL_COMMAND_SEQUENCE,
+	PROTOCOL_COMMAND_FEEDFORWARD,
+	PROTOCOL_COMMAND_STATS,
+	PROTOCOL_COMMAND_TEMPERATURE,
+	PROTOCOL_COMMAND_ADDRESS,
+	PROTOCOL_COMMAND_POLL
 } protocol_command;
 
+// state values that can be streamed, in the order they are sent
+typedef enum {
+	PROTOCOL_FIELD_VOLTS,
+	PROTOCOL_FIELD_AMPS,
+	PROTOCOL_FIELD_WATTS,
+	PROTOCOL_FIELD_TARGETAMPS,
+	PROTOCOL_FIELD_LVC,
+	PROTOCOL_FIELD_LOADDUTY,
+	PROTOCOL_FIELD_TIME,
+	PROTOCOL_FIELD_AMPHOURS,
+	PROTOCOL_FIELD_WATTHOURS,
+	PROTOCOL_FIELD_RESISTANCE,
+	PROTOCOL_FIELD_TIMEHIGH, // TIME is the low 16 bits of the run time
+	PROTOCOL_FIELD_MILLIS, // ms timestamp of the readings, low 16 bits
+	PROTOCOL_FIELD_MILLISHIGH,
+	PROTOCOL_FIELD_WATTHOURSHIGH, // WATTHOURS is the low 16 bits of the mWh
+	PROTOCOL_FIELD_END
+} protocol_field;
+
+#define PROTOCOL_FIELDS_DEFAULT		0b00111111
+
+/* binary state frame, all values little endian
+ *
+ * 0		sync, PROTOCOL_SYNC
+ * 1		type, PROTOCOL_FRAME_STATE
+ * 2		sequence number, increments with every frame
+ * 3		operation mode
+ * 4-5		field mask, bit n set if protocol_field n is in the frame
+ * 6-		uint16 for each field in the mask
+ * last		crc-8 (poly 0x07, init 0) over everything but the sync byte
+ */
+
+/* binary log dump, sent in answer to DUMP
+ *
+ * 0		sync, PROTOCOL_SYNC
+ * 1		type, PROTOCOL_FRAME_LOG
+ * 2-3		number of records
+ * 4-		records oldest first, run time in seconds as uint32, volts
+ * 			and amps as uint16 each
+ * last		crc-8 over everything but the sync byte
+ */
+#define PROTOCOL_SYNC			0xa5
+#define PROTOCOL_FRAME_STATE	0x01
+#define PROTOCOL_FRAME_LOG		0x02
+
+void protocol_init(void);
 void protocol_onbooted(void);
 void protocol_sendstate(void);
+void protocol_onreadings(void);
+void protocol_checkpending(void);
+#ifdef PERF
+bool protocol_sendperf(void);
+#endif
 void protocol_checkcommand(void);
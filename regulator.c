@@ -0,0 +1,73 @@
+#include "regulator.h"
+#include "load.h"
+
+// the regulator works on how hard the load is being driven rather than
+// the duty itself, more drive means more current
+#define MAXDRIVE ((int32_t) (OFFDUTY - LOAD_MINDUTY))
+#define MINDRIVE ((int32_t) (OFFDUTY - LOAD_MAXDUTY))
+
+static int16_t kp = REGULATOR_KP;
+static int16_t ki = REGULATOR_KI;
+#ifdef REGULATOR_PID
+static int16_t kd = REGULATOR_KD;
+static uint16_t lastactual = 0;
+#endif
+
+static int32_t integral = 0;
+
+void regulator_setgains(int16_t newkp, int16_t newki, int16_t newkd) {
+	kp = newkp;
+	ki = newki;
+#ifdef REGULATOR_PID
+	kd = newkd;
+#else
+	(void) newkd;
+#endif
+}
+
+// start regulating from the passed duty without a bump
+void regulator_reset(uint16_t duty) {
+	if (duty > LOAD_MAXDUTY)
+		duty = LOAD_MAXDUTY;
+	else if (duty < LOAD_MINDUTY)
+		duty = LOAD_MINDUTY;
+	integral = ((int32_t) (OFFDUTY - duty)) << REGULATOR_SHIFT;
+#ifdef REGULATOR_PID
+	lastactual = 0;
+#endif
+}
+
+uint16_t regulator_update(uint16_t target, uint16_t actual) {
+	int16_t error = (int16_t) (target - actual);
+	int32_t newintegral = integral + ((int32_t) ki * error);
+	int32_t drive = (int32_t) kp * error;
+
+#ifdef REGULATOR_PID
+	// on the measurement so setpoint changes don't kick the output
+	if (lastactual != 0)
+		drive -= (int32_t) kd * (int16_t) (actual - lastactual);
+	lastactual = actual;
+#endif
+
+	drive = (drive + newintegral) >> REGULATOR_SHIFT;
+
+	// anti-windup, stop integrating once the output is pinned and the
+	// error is still pushing it further out
+	if (drive > MAXDRIVE) {
+		drive = MAXDRIVE;
+		if (error < 0)
+			integral = newintegral;
+	} else if (drive < MINDRIVE) {
+		drive = MINDRIVE;
+		if (error > 0)
+			integral = newintegral;
+	} else
+		integral = newintegral;
+
+	if (integral > (MAXDRIVE << REGULATOR_SHIFT))
+		integral = MAXDRIVE << REGULATOR_SHIFT;
+	else if (integral < (MINDRIVE << REGULATOR_SHIFT))
+		integral = MINDRIVE << REGULATOR_SHIFT;
+
+	return OFFDUTY - (uint16_t) drive;
+}
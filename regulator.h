@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+// gains are in duty counts per mA of error, scaled by 2^REGULATOR_SHIFT
+#define REGULATOR_SHIFT 12
+
+#ifndef REGULATOR_KP
+#define REGULATOR_KP 150
+#endif
+
+#ifndef REGULATOR_KI
+#define REGULATOR_KI 25
+#endif
+
+// the derivative term only gets built in with REGULATOR_PID
+#ifndef REGULATOR_KD
+#define REGULATOR_KD 0
+#endif
+
+void regulator_setgains(int16_t kp, int16_t ki, int16_t kd);
+void regulator_reset(uint16_t duty);
+uint16_t regulator_update(uint16_t target, uint16_t actual);
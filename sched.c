@@ -0,0 +1,110 @@
+#include "sched.h"
+#include "events.h"
+#include "timer.h"
+
+// a task that has been held back this many times runs regardless, that
+// goes for being cut off by a new reading as well as not fitting so every
+// task, the watchdog one included, gets to run at least every
+// MAXDEFERRALS + 1 passes
+#define MAXDEFERRALS 4
+
+static uint8_t posted = 0;
+static bool critical = false;
+
+// how far apart the control task runs, averaged over 8 runs
+static uint16_t controlinterval = 0;
+static uint16_t controlstart = 0;
+
+// from a task, for other tasks
+void sched_post(uint8_t event) {
+	posted |= event;
+}
+
+// while critical the control task gets the cpu whenever it needs it
+void sched_setcritical(bool newcritical) {
+	critical = newcritical;
+}
+
+static bool sched_isdue(sched_task* task, uint8_t pending, uint32_t now) {
+	if (pending & task->events)
+		return true;
+	return task->period != 0 && now - task->lastrun >= task->period;
+}
+
+// only start a task if it will be done before the control task needs to
+// run again
+static bool sched_fits(sched_task* task) {
+	uint16_t sincecontrol;
+
+	if (!critical || task->deferred >= MAXDEFERRALS)
+		return true;
+
+	sincecontrol = timer_micros() - controlstart;
+	return (uint32_t) sincecontrol + task->budget <= controlinterval;
+}
+
+static void sched_runtask(sched_task* task, uint8_t pending, uint32_t now,
+		bool control) {
+	uint16_t start = timer_micros();
+	uint16_t runtime;
+
+	if (control) {
+		controlinterval += (int16_t) ((uint16_t) (start - controlstart)
+				- controlinterval) >> 3;
+		controlstart = start;
+	}
+
+	task->run(pending & task->events);
+
+	runtime = timer_micros() - start;
+	if (runtime > task->longest)
+		task->longest = runtime;
+	if (runtime > task->budget)
+		task->overruns++;
+	task->lastrun = now;
+	task->deferred = 0;
+}
+
+void sched_run(sched_task* tasks, uint8_t ntasks) {
+	uint8_t pending = 0;
+	uint8_t keep;
+	uint32_t now;
+	uint8_t i;
+	sched_task* task;
+	bool cut;
+
+	while (1) {
+		// don't sleep while there is still something left over
+		if (posted != 0 || pending != 0)
+			pending |= events_take();
+		else
+			pending = events_wait();
+		pending |= posted;
+		posted = 0;
+
+		now = timer_millis();
+		keep = 0;
+		cut = false;
+		for (i = 0; i < ntasks; i++) {
+			task = &tasks[i];
+			if (!sched_isdue(task, pending, now))
+				continue;
+
+			if (i != 0
+					&& ((cut && task->deferred < MAXDEFERRALS)
+							|| !sched_fits(task))) {
+				task->deferred++;
+				keep |= pending & task->events;
+				continue;
+			}
+
+			sched_runtask(task, pending, now, i == 0);
+
+			// with a new reading to work on the rest of the pass is held
+			// back for the next one, apart from what's been waiting too long
+			if (i != 0 && critical && (events & tasks[0].events))
+				cut = true;
+		}
+		pending = keep;
+	}
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// events tasks can post for each other, above the ones the isrs post
+#define EVENT_READINGS		(1 << 4)
+#define EVENT_STATECHANGED	(1 << 5)
+
+// tasks run in table order, the first one is the control task
+typedef struct {
+	void (*run)(uint8_t pending);
+	uint8_t events; // events that make the task runnable
+	uint16_t period; // ms between runs or 0 for only on events
+	uint16_t budget; // worst case run time in us
+	// kept by the scheduler
+	uint32_t lastrun;
+	uint16_t longest;
+	uint16_t overruns;
+	uint8_t deferred;
+} sched_task;
+
+void sched_post(uint8_t event);
+void sched_setcritical(bool critical);
+void sched_run(sched_task* tasks, uint8_t ntasks);
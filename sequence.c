@@ -0,0 +1,206 @@
+#include "sequence.h"
+#include "state.h"
+#include "timer.h"
+#include "eeprom.h"
+#include "util.h"
+
+#define CRCSEED 0xff
+#define MILLISPERSECOND 1000
+
+static sequence_step steps[SEQUENCE_MAXSTEPS];
+static uint8_t numsteps = 0;
+
+static sequence_result results[SEQUENCE_MAXSTEPS];
+static uint8_t numresults = 0;
+
+static sequence_status status = SEQUENCE_IDLE;
+static uint8_t current;
+static uint16_t stepseconds;
+static uint32_t lastsecond;
+
+// steps go in in order, an index one past the end adds a step
+bool sequence_setstep(uint8_t index, sequence_step* step) {
+	if (status == SEQUENCE_RUNNING || index > numsteps
+			|| index >= SEQUENCE_MAXSTEPS || step->mode >= SEQUENCE_MODEEND
+			|| step->exit >= SEQUENCE_EXIT_END)
+		return false;
+
+	// a step that never ends would stall the rest of the sequence
+	if (step->seconds == 0 && step->exit == SEQUENCE_EXIT_NONE)
+		return false;
+
+	steps[index] = *step;
+	if (index == numsteps)
+		numsteps++;
+	return true;
+}
+
+void sequence_clear(void) {
+	if (status == SEQUENCE_RUNNING)
+		return;
+	numsteps = 0;
+	numresults = 0;
+	status = SEQUENCE_IDLE;
+}
+
+static bool sequence_enterstep(void) {
+	sequence_step* step = &steps[current];
+
+	stepseconds = 0;
+	lastsecond = timer_millis();
+
+	switch (step->mode) {
+	case SEQUENCE_REST:
+		return om == OPMODE_OFF || state_changeopmode(OPMODE_OFF);
+	case SEQUENCE_CC:
+		rm = REGMODE_CC;
+		break;
+	case SEQUENCE_CR:
+		rm = REGMODE_CR;
+		break;
+	case SEQUENCE_CP:
+		rm = REGMODE_CP;
+		break;
+	}
+
+	// going from one load step to the next leaves the load on
+	*state_setpoint() = step->setpoint;
+	return om == OPMODE_ON || state_changeopmode(OPMODE_ON);
+}
+
+static void sequence_endstep(sequence_ended ended) {
+	sequence_result* result = &results[numresults++];
+
+	result->ended = ended;
+	result->seconds = stepseconds;
+	result->volts = volts;
+	result->amps = amps;
+	result->amphours = amphours;
+}
+
+// the load has to be off to start, the results of the last run are
+// thrown away
+bool sequence_start(void) {
+	if (status == SEQUENCE_RUNNING || numsteps == 0 || om != OPMODE_OFF)
+		return false;
+
+	numresults = 0;
+	current = 0;
+	status = SEQUENCE_RUNNING;
+	if (!sequence_enterstep()) {
+		status = SEQUENCE_ABORTED;
+		return false;
+	}
+	return true;
+}
+
+static void sequence_abort(void) {
+	sequence_endstep(SEQUENCE_ENDED_ABORTED);
+	status = SEQUENCE_ABORTED;
+	// a trip is left showing
+	if (state_loadon())
+		state_changeopmode(OPMODE_OFF);
+}
+
+void sequence_stop(void) {
+	if (status == SEQUENCE_RUNNING)
+		sequence_abort();
+}
+
+static bool sequence_exitmet(sequence_step* step) {
+	switch (step->exit) {
+	case SEQUENCE_EXIT_VBELOW:
+		return volts < step->limit;
+	case SEQUENCE_EXIT_VABOVE:
+		return volts > step->limit;
+	case SEQUENCE_EXIT_ABELOW:
+		return amps < step->limit;
+	case SEQUENCE_EXIT_AABOVE:
+		return amps > step->limit;
+	case SEQUENCE_EXIT_AHABOVE:
+		return amphours > step->limit;
+	default:
+		return false;
+	}
+}
+
+// with every new set of readings, true if it's changed the operation mode
+bool sequence_update(void) {
+	sequence_step* step;
+	operationmode lastmode = om;
+	uint32_t now;
+
+	if (status != SEQUENCE_RUNNING)
+		return false;
+
+	step = &steps[current];
+	now = timer_millis();
+	while (now - lastsecond >= MILLISPERSECOND) {
+		lastsecond += MILLISPERSECOND;
+		stepseconds++;
+	}
+
+	// a trip or someone pressing a button ends the whole thing
+	if ((step->mode == SEQUENCE_REST) != (om == OPMODE_OFF)) {
+		sequence_abort();
+		return om != lastmode;
+	}
+
+	// the readings need a moment to catch up with a new setpoint
+	if (stepseconds >= SEQUENCE_SETTLESECONDS && sequence_exitmet(step))
+		sequence_endstep(SEQUENCE_ENDED_EXIT);
+	else if (step->seconds != 0 && stepseconds >= step->seconds)
+		sequence_endstep(SEQUENCE_ENDED_TIME);
+	else
+		return false;
+
+	current++;
+	if (current == numsteps) {
+		status = SEQUENCE_DONE;
+		state_changeopmode(OPMODE_OFF);
+	} else if (!sequence_enterstep())
+		sequence_abort();
+
+	return om != lastmode;
+}
+
+sequence_status sequence_getstatus(void) {
+	return status;
+}
+
+uint8_t sequence_results(void) {
+	return numresults;
+}
+
+void sequence_getresult(uint8_t index, sequence_result* result) {
+	*result = results[index];
+}
+
+// the number of steps, the steps and a crc
+void sequence_save(void) {
+	uint8_t* bytes = (uint8_t*) steps;
+	uint8_t len = numsteps * sizeof(sequence_step);
+	uint8_t crc = crc8(crc8(CRCSEED, &numsteps, 1), bytes, len);
+
+	eeprom_writeblocking(EEPROM_SEQUENCE, &numsteps, 1);
+	eeprom_writeblocking(EEPROM_SEQUENCE + 1, bytes, len);
+	eeprom_writeblocking(EEPROM_SEQUENCE + 1 + len, &crc, 1);
+}
+
+// picks up a saved sequence so a station doesn't have to upload it again
+void sequence_init(void) {
+	uint8_t* bytes = (uint8_t*) steps;
+	uint8_t count = eeprom_read(EEPROM_SEQUENCE);
+	uint8_t len, i;
+
+	if (count > SEQUENCE_MAXSTEPS)
+		return;
+
+	len = count * sizeof(sequence_step);
+	for (i = 0; i < len; i++)
+		bytes[i] = eeprom_read(EEPROM_SEQUENCE + 1 + i);
+
+	if (crc8(crc8(CRCSEED, &count, 1), bytes, len)
+			== eeprom_read(EEPROM_SEQUENCE + 1 + len))
+		numsteps = count;
+}
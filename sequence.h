@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// runs a table of steps without the host, each holds a setpoint until its
+// time is up or its exit condition is met and then moves on to the next
+
+#define SEQUENCE_MAXSTEPS 8
+
+// exit conditions aren't looked at until a step has run this long
+#define SEQUENCE_SETTLESECONDS 1
+
+typedef enum {
+	SEQUENCE_REST, // load off
+	SEQUENCE_CC,
+	SEQUENCE_CR,
+	SEQUENCE_CP,
+	SEQUENCE_MODEEND
+} sequence_mode;
+
+// checked against the latest readings, amphours count from when the
+// load went on
+typedef enum {
+	SEQUENCE_EXIT_NONE,
+	SEQUENCE_EXIT_VBELOW,
+	SEQUENCE_EXIT_VABOVE,
+	SEQUENCE_EXIT_ABELOW,
+	SEQUENCE_EXIT_AABOVE,
+	SEQUENCE_EXIT_AHABOVE,
+	SEQUENCE_EXIT_END
+} sequence_exit;
+
+// mode and exit are sequence_mode and sequence_exit, seconds of 0 means
+// the step only ends on its exit condition
+typedef struct {
+	uint8_t mode;
+	uint8_t exit;
+	uint16_t setpoint;
+	uint16_t seconds;
+	uint16_t limit;
+} sequence_step;
+
+typedef enum {
+	SEQUENCE_ENDED_TIME, SEQUENCE_ENDED_EXIT, SEQUENCE_ENDED_ABORTED
+} sequence_ended;
+
+// how each step that has run went, with the readings it ended on
+typedef struct {
+	uint8_t ended;
+	uint16_t seconds;
+	uint16_t volts;
+	uint16_t amps;
+	uint16_t amphours;
+} sequence_result;
+
+typedef enum {
+	SEQUENCE_IDLE, SEQUENCE_RUNNING, SEQUENCE_DONE, SEQUENCE_ABORTED
+} sequence_status;
+
+bool sequence_setstep(uint8_t index, sequence_step* step);
+void sequence_clear(void);
+bool sequence_start(void);
+void sequence_stop(void);
+bool sequence_update(void);
+sequence_status sequence_getstatus(void);
+uint8_t sequence_results(void);
+void sequence_getresult(uint8_t index, sequence_result* result);
+void sequence_save(void);
+void sequence_init(void);
@@ -0,0 +1,74 @@
+#include "setpoint.h"
+#include "state.h"
+
+// 1/x is kept as a 16 bit mantissa scaled so that x << shift times
+// the mantissa is about 2^31
+typedef struct {
+	uint16_t mantissa;
+	uint8_t shift;
+} reciprocal;
+
+// 2^31 / x for the middle of each 1/32nd of 0x8000 - 0xffff, the
+// newton step takes it from there
+static const uint16_t seeds[] = { 64528, 62602, 60787, 59075, 57456, 55924,
+		54471, 53092, 51782, 50534, 49345, 48210, 47127, 46091, 45100, 44151,
+		43240, 42367, 41528, 40721, 39946, 39199, 38480, 37787, 37118, 36472,
+		35849, 35246, 34664, 34100, 33554, 33026 };
+
+static void setpoint_reciprocal(uint16_t x, reciprocal* r) {
+	uint8_t shift = 0;
+	uint16_t seed;
+	int32_t error, m;
+
+	if (x == 0)
+		x = 1;
+
+	while (!(x & 0x8000)) {
+		x <<= 1;
+		shift++;
+	}
+
+	// one newton step, m += m * (1 - x * m / 2^31)
+	seed = seeds[(x >> 10) & 0x1f];
+	error = (int32_t) (0x80000000 - (uint32_t) x * seed);
+	m = seed + ((seed * (error >> 15)) >> 16);
+
+	// 1/0x8000 is just out of reach
+	r->mantissa = m > 0xffff ? 0xffff : (uint16_t) m;
+	r->shift = shift;
+}
+
+// x * 1000 / y, saturating
+static uint16_t setpoint_scaleddivide(uint16_t x, reciprocal* y) {
+	uint32_t q = (uint32_t) x * y->mantissa;
+	q = ((q >> 10) * 1000) >> (21 - y->shift);
+	if (q > 0xffff)
+		return 0xffff;
+	return (uint16_t) q;
+}
+
+uint16_t setpoint_targetamps(void) {
+	// the resistance only changes when the user sets it so its reciprocal
+	// is kept around
+	static uint16_t lastohms = 0;
+	static reciprocal ohms;
+
+	switch (rm) {
+	case REGMODE_CR:
+		if (targetohms != lastohms) {
+			setpoint_reciprocal(targetohms, &ohms);
+			lastohms = targetohms;
+		}
+		return setpoint_scaleddivide(volts, &ohms);
+	case REGMODE_CP:
+		return setpoint_divide(targetwatts, volts);
+	default:
+		return targetamps;
+	}
+}
+
+uint16_t setpoint_divide(uint16_t x, uint16_t y) {
+	reciprocal r;
+	setpoint_reciprocal(y, &r);
+	return setpoint_scaleddivide(x, &r);
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdint.h>
+
+// works out the current to regulate to for the regulation mode, volts
+// and targetohms/targetwatts go in without dividing
+uint16_t setpoint_targetamps(void);
+// x * 1000 / y the same way, saturating
+uint16_t setpoint_divide(uint16_t x, uint16_t y);
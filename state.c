@@ -1,18 +1,33 @@
 #include "state.h"
+#include "timer.h"
+#include "load.h"
 
 bool highgain = false;
 uint16_t lvc = 2000;
+// the shunt reads full scale a little under 3.5A
+uint16_t ocp = 3400;
+uint16_t opp = 35000;
 uint16_t targetamps = 1000;
+uint16_t targetohms = 10000;
+uint16_t targetwatts = 5000;
 uint16_t volts = 0;
 uint16_t amps = 0;
 uint16_t amphours = 0;
+uint32_t watthours = 0;
 uint16_t watts = 0;
-uint16_t loadduty = 800;
 uint8_t digitbeingset = 0;
-uint16_t time = 0;
+uint32_t time = 0;
+// last internal resistance measurement, mOhm
+uint16_t resistance = 0;
 displaymode dm = VOLTS;
 operationmode om = OPMODE_OFF;
-uint8_t sequence = 0;
+regulationmode rm = REGMODE_CC;
+
+// two copies so there's always one that isn't being written, readers use
+// the one the low bit of the sequence points at and try again if it
+// moved while they were copying
+static volatile state_snapshot snapshots[2];
+static volatile uint8_t snapshotseq = 0;
 
 bool state_changeopmode(operationmode newmode) {
 
@@ -20,17 +35,23 @@ bool state_changeopmode(operationmode newmode) {
 
 	switch (om) {
 	case OPMODE_ON:
+	case OPMODE_TRANSIENT:
 		if (newmode == OPMODE_OFF)
 			changeok = true;
 		break;
 	case OPMODE_OFF:
-		if (newmode == OPMODE_ON)
+		if (newmode == OPMODE_ON || newmode == OPMODE_TRANSIENT)
 			changeok = true;
 		break;
 	case OPMODE_LVC:
+	case OPMODE_OCP:
+	case OPMODE_OPP:
 		if (newmode == OPMODE_OFF)
 			changeok = true;
 		break;
+	case OPMODE_SET:
+		// only the buttons leave set
+		break;
 	}
 
 	if (changeok)
@@ -38,3 +59,55 @@ bool state_changeopmode(operationmode newmode) {
 
 	return changeok;
 }
+
+bool state_loadon(void) {
+	return om == OPMODE_ON || om == OPMODE_TRANSIENT;
+}
+
+// the setpoint for the regulation mode, this is what gets edited in
+// OPMODE_SET
+uint16_t* state_setpoint(void) {
+	switch (rm) {
+	case REGMODE_CR:
+		return &targetohms;
+	case REGMODE_CP:
+		return &targetwatts;
+	default:
+		return &targetamps;
+	}
+}
+
+// main loop only
+void state_publish(void) {
+	static uint8_t version = 0;
+	state_snapshot snapshot;
+
+	snapshot.version = ++version;
+	snapshot.om = om;
+	snapshot.highgain = highgain;
+	snapshot.volts = volts;
+	snapshot.amps = amps;
+	snapshot.watts = watts;
+	snapshot.amphours = amphours;
+	snapshot.watthours = watthours;
+	snapshot.loadduty = load_getduty();
+	snapshot.time = timer_runtime();
+	snapshot.resistance = resistance;
+	snapshot.millis = timer_millis();
+
+	// readers go over to the second copy while the first is written
+	snapshotseq++;
+	snapshots[0] = snapshot;
+	snapshotseq++;
+	snapshots[1] = snapshot;
+}
+
+// never waits on the writer so it's safe from isrs
+void state_getsnapshot(state_snapshot* snapshot) {
+	uint8_t seq;
+
+	do {
+		seq = snapshotseq;
+		*snapshot = snapshots[seq & 1];
+	} while (seq != snapshotseq);
+}
@@ -10,20 +10,58 @@ typedef enum {
 	OPMODE_SET, // user is setting parameters, load is off
 	OPMODE_ON, // load is on
 	OPMODE_LVC, // low voltage cutoff triggered, load is off
+	OPMODE_OCP, // over current protection tripped, load is off
+	OPMODE_OPP, // over power protection tripped, load is off
+	OPMODE_TRANSIENT, // load is on and switching between two currents
 } operationmode;
 
+typedef enum {
+	REGMODE_CC, // constant current, targetamps in mA
+	REGMODE_CR, // constant resistance, targetohms in mOhm
+	REGMODE_CP, // constant power, targetwatts in mW
+	REGMODE_END
+} regulationmode;
+
+// a consistent copy of the readings and the mode, published from the main
+// loop after every update. the globals are only safe to use from the main
+// loop, anything else should read a snapshot
+typedef struct {
+	uint8_t version;
+	operationmode om;
+	bool highgain;
+	uint16_t volts;
+	uint16_t amps;
+	uint16_t watts;
+	uint16_t amphours;
+	uint32_t watthours;
+	uint16_t loadduty;
+	uint32_t time;
+	uint16_t resistance;
+	// when it was published, from timer_millis()
+	uint32_t millis;
+} state_snapshot;
+
 extern bool highgain;
 extern uint16_t lvc;
+extern uint16_t ocp;
+extern uint16_t opp;
 extern uint16_t targetamps;
+extern uint16_t targetohms;
+extern uint16_t targetwatts;
 extern uint16_t volts;
 extern uint16_t amps;
 extern uint16_t amphours;
+extern uint32_t watthours;
 extern uint16_t watts;
-extern uint16_t loadduty;
 extern uint8_t digitbeingset;
-extern uint16_t time;
+extern uint32_t time;
+extern uint16_t resistance;
 extern displaymode dm;
 extern operationmode om;
-extern uint8_t sequence;
+extern regulationmode rm;
 
 bool state_changeopmode(operationmode newmode);
+bool state_loadon(void);
+uint16_t* state_setpoint(void);
+void state_publish(void);
+void state_getsnapshot(state_snapshot* snapshot);
@@ -0,0 +1,72 @@
+#include "stats.h"
+#include "state.h"
+
+typedef struct {
+	uint16_t min;
+	uint16_t max;
+	uint32_t sum;
+} accumulator;
+
+static accumulator accumulators[STATS_END];
+static stats_summary summaries[STATS_END];
+
+static uint8_t windowshift = STATS_WINDOWSHIFT;
+static uint16_t readings = 0;
+// windows finished so far, so the host can tell a new summary from the
+// last one
+static uint16_t windows = 0;
+
+static void stats_add(accumulator* a, uint16_t value) {
+	if (readings == 0) {
+		a->min = value;
+		a->max = value;
+		a->sum = value;
+		return;
+	}
+
+	if (value < a->min)
+		a->min = value;
+	if (value > a->max)
+		a->max = value;
+	a->sum += value;
+}
+
+void stats_update(void) {
+	stats_channel channel;
+	accumulator* a;
+
+	stats_add(&accumulators[STATS_VOLTS], volts);
+	stats_add(&accumulators[STATS_AMPS], amps);
+	readings++;
+
+	if (readings >> windowshift == 0)
+		return;
+
+	for (channel = 0; channel < STATS_END; channel++) {
+		a = &accumulators[channel];
+		summaries[channel].min = a->min;
+		summaries[channel].max = a->max;
+		summaries[channel].mean = (uint16_t) (a->sum >> windowshift);
+	}
+	readings = 0;
+	windows++;
+}
+
+// starts the window that's in progress over
+bool stats_setwindow(uint8_t shift) {
+	if (shift > STATS_MAXWINDOWSHIFT)
+		return false;
+	windowshift = shift;
+	readings = 0;
+	return true;
+}
+
+uint8_t stats_getwindow(void) {
+	return windowshift;
+}
+
+// the last finished window, returns how many there have been
+uint16_t stats_get(stats_channel channel, stats_summary* summary) {
+	*summary = summaries[channel];
+	return windows;
+}
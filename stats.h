@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// min, max and mean of the volts and amps over windows of 2^n readings,
+// worked out as the readings come in
+
+#define STATS_MAXWINDOWSHIFT 15
+
+#ifndef STATS_WINDOWSHIFT
+#define STATS_WINDOWSHIFT 8
+#endif
+
+typedef struct {
+	uint16_t min;
+	uint16_t max;
+	uint16_t mean;
+} stats_summary;
+
+typedef enum {
+	STATS_VOLTS, STATS_AMPS, STATS_END
+} stats_channel;
+
+void stats_update(void);
+bool stats_setwindow(uint8_t shift);
+uint8_t stats_getwindow(void);
+uint16_t stats_get(stats_channel channel, stats_summary* summary);
@@ -2,6 +2,7 @@
 #include <stdint.h>
 
 #define enableInterrupts()    __asm__("rim\n")
+#define disableInterrupts()   __asm__("sim\n")
 #define waitforinterrupt()    __asm__("wfi\n")
 
 #define ODRREG(base) (base)
@@ -74,34 +75,43 @@
 #define UART2_PSCR	(*(volatile uint8_t*)(UART2_BASE + 0xb))
 
 #define ADC_DBBASE	0x53E0
-#define ADC_DB0R	(volatile uint8_t*)(ADC_DBBASE)
-#define ADC_DB1R	(volatile uint8_t*)(ADC_DBBASE + 1)
-#define ADC_DB2R	(volatile uint8_t*)(ADC_DBBASE + 2)
-#define ADC_DB3R	(volatile uint8_t*)(ADC_DBBASE + 3)
+#define ADC_DBRH(n)	(*(volatile uint8_t*)(ADC_DBBASE + ((n) * 2)))
+#define ADC_DBRL(n)	(*(volatile uint8_t*)(ADC_DBBASE + ((n) * 2) + 1))
 
 #define ADC_BASE		0x5400
 #define ADC_CSR			(*(volatile uint8_t*)(ADC_BASE))
+#define ADC_CSR_AWDIE	(1 << 4)
 #define ADC_CSR_EOCIE	(1 << 5)
+#define ADC_CSR_AWD		(1 << 6)
 #define ADC_CSR_EOC		(1 << 7)
 
 #define ADC_CR1		(*(volatile uint8_t*)(ADC_BASE + 1))
 #define ADC_CR1_ADON	(1)
 #define ADC_CR1_CONT	(1 << 1)
 
-#define ADC_CR2		(volatile uint8_t*)(ADC_BASE + 2)
-#define ADC_CR3		(volatile uint8_t*)(ADC_BASE + 3)
+#define ADC_CR2			(*(volatile uint8_t*)(ADC_BASE + 2))
+#define ADC_CR2_SCAN	(1 << 1)
+#define ADC_CR2_ALIGN	(1 << 3)
+#define ADC_CR2_EXTTRIG	(1 << 6)
+
+#define ADC_CR3			(*(volatile uint8_t*)(ADC_BASE + 3))
+#define ADC_CR3_OVR		(1 << 6)
+#define ADC_CR3_DBUF	(1 << 7)
+
 #define ADC_DRH		(*(volatile uint8_t*)(ADC_BASE + 4))
 #define ADC_DRL		(*(volatile uint8_t*)(ADC_BASE + 5))
 #define ADC_TDRH	(volatile uint8_t*)(ADC_BASE + 6)
 #define ADC_TDRL	(volatile uint8_t*)(ADC_BASE + 7)
-#define ADC_HTRH	(volatile uint8_t*)(ADC_BASE + 8)
-#define ADC_HTRL	(volatile uint8_t*)(ADC_BASE + 9)
-#define ADC_LTRH	(volatile uint8_t*)(ADC_BASE + a)
-#define ADC_LTRL	(volatile uint8_t*)(ADC_BASE + b)
-#define ADC_AWSRH	(volatile uint8_t*)(ADC_BASE + c)
-#define ADC_AWSRL	(volatile uint8_t*)(ADC_BASE + d)
-#define ADC_AWCRH	(volatile uint8_t*)(ADC_BASE + e)
-#define ADC_AWCRL	(volatile uint8_t*)(ADC_BASE + f)
+// analog watchdog thresholds are the top 8 bits in H and the bottom 2 in L
+#define ADC_HTRH	(*(volatile uint8_t*)(ADC_BASE + 0x8))
+#define ADC_HTRL	(*(volatile uint8_t*)(ADC_BASE + 0x9))
+#define ADC_LTRH	(*(volatile uint8_t*)(ADC_BASE + 0xa))
+#define ADC_LTRL	(*(volatile uint8_t*)(ADC_BASE + 0xb))
+// one bit per channel, AIN0 is bit 0 of L
+#define ADC_AWSRH	(*(volatile uint8_t*)(ADC_BASE + 0xc))
+#define ADC_AWSRL	(*(volatile uint8_t*)(ADC_BASE + 0xd))
+#define ADC_AWCRH	(*(volatile uint8_t*)(ADC_BASE + 0xe))
+#define ADC_AWCRL	(*(volatile uint8_t*)(ADC_BASE + 0xf))
 
 #define CLK_BASE	0x50C0
 #define CLK_ICKR	(volatile uint8_t*)(CLK_BASE)
@@ -122,7 +132,9 @@
 #define TIM1_CR1_ARPE	(1 << 7)
 #define TIM1_CR1_CEN	1
 
-#define TIM1_CR2	(*(volatile uint8_t*)(TIM1_BASE + 0x1))
+#define TIM1_CR2			(*(volatile uint8_t*)(TIM1_BASE + 0x1))
+#define TIM1_CR2_MMS_UPDATE	(0b010 << 4)
+
 #define TIM1_SMCR	(*(volatile uint8_t*)(TIM1_BASE + 0x2))
 #define TIM1_ETR	(*(volatile uint8_t*)(TIM1_BASE + 0x3))
 #define TIM1_IER	(*(volatile uint8_t*)(TIM1_BASE + 0x4))
@@ -258,6 +270,18 @@
 #define EXTI_CR2_TLIS_FALLING		0
 #define EXTI_CR2_TLIS_RISING		(1 << 2)
 
+#define FLASH_BASE					0x505A
+#define FLASH_IAPSR					(*(volatile uint8_t*)(FLASH_BASE + 0x5))
+#define FLASH_IAPSR_EOP				(1 << 2)
+#define FLASH_IAPSR_DUL				(1 << 3)
+#define FLASH_DUKR					(*(volatile uint8_t*)(FLASH_BASE + 0xa))
+#define FLASH_DUKR_KEY1				0xAE
+#define FLASH_DUKR_KEY2				0x56
+
+#define EEPROM_BASE					0x4000
+#define EEPROM_SIZE					1024
+#define EEPROM(offset)				(*(volatile uint8_t*)(EEPROM_BASE + (offset)))
+
 #define IWDG_BASE					0x50E0
 #define IWDG_KR						(*(volatile uint8_t*)(IWDG_BASE))
 #define IWDG_KR_ENABLE				0xCC
@@ -0,0 +1,311 @@
+#include <stdio.h>
+
+#include "stm8.h"
+#include "state.h"
+#include "bcd.h"
+#include "setpoint.h"
+#include "calibration.h"
+#include "protection.h"
+#include "stats.h"
+#include "feedforward.h"
+#include "load.h"
+#include "eeprom.h"
+#include "datalog.h"
+#include "uart.h"
+#include "protocol.h"
+#include "timer.h"
+#include "energy.h"
+#include "perf.h"
+#include "thermal.h"
+#include "transient.h"
+
+// regression tests for the modules that don't need the hardware, run on
+// the host by make test against the register mock of stm8.h
+
+volatile uint8_t stm8_registers[0x10000];
+
+static int failures = 0;
+
+#define CHECK(condition) test_check((condition), #condition, __LINE__)
+
+static void test_check(bool ok, const char* what, int line) {
+	if (ok)
+		return;
+	printf("tests.c:%d: %s\n", line, what);
+	failures++;
+}
+
+static void test_bcd(void) {
+	uint8_t digits[5];
+
+	bcd_split(12345, digits, 5);
+	CHECK(digits[0] == 1 && digits[1] == 2 && digits[4] == 5);
+	CHECK(bcd_pack(digits, 5) == 12345);
+
+	// setpoints of 10000 and up keep their top digit
+	bcd_split(60000, digits, 5);
+	CHECK(bcd_pack(digits, 5) == 60000);
+
+	CHECK(bcd_splitsuppressed(42, digits, 5) == 2);
+	CHECK(digits[0] == 4 && digits[1] == 2);
+	CHECK(bcd_splitsuppressed(0, digits, 5) == 1);
+}
+
+// the reciprocal divide rounds down by a count or so
+static bool test_near(uint16_t value, uint16_t expected) {
+	return value <= expected && value + 2 >= expected;
+}
+
+static void test_setpoint(void) {
+	CHECK(test_near(setpoint_divide(1000, 500), 2000));
+	CHECK(test_near(setpoint_divide(5000, 1000), 5000));
+	CHECK(test_near(setpoint_divide(12000, 4000), 3000));
+	CHECK(test_near(setpoint_divide(60000, 1000), 60000));
+	CHECK(setpoint_divide(1000, 0) == 0xffff);
+	CHECK(setpoint_divide(60000, 10) == 0xffff);
+}
+
+static void test_calibration(void) {
+	uint16_t raw, value;
+
+	calibration_reset();
+	for (raw = 1 << CALIBRATION_RAWSHIFT; raw < 0xf000; raw += 0x1000) {
+		value = calibration_apply(CALIBRATION_SHUNT, raw);
+		// one count either way
+		CHECK(calibration_unapply(CALIBRATION_SHUNT, value) + 64 >= raw);
+		CHECK(calibration_unapply(CALIBRATION_SHUNT, value) <= raw + 64);
+	}
+	CHECK(calibration_unapply(CALIBRATION_SHUNT, 0) == 0);
+}
+
+static void test_protection(void) {
+	calibration_reset();
+	// the default ocp has to be somewhere the shunt can see
+	CHECK(protection_maxamps() > 3400 && protection_maxamps() < 3500);
+	CHECK(ocp <= protection_maxamps());
+}
+
+static void test_stats(void) {
+	CHECK(stats_setwindow(STATS_MAXWINDOWSHIFT));
+	CHECK(stats_getwindow() == STATS_MAXWINDOWSHIFT);
+	CHECK(!stats_setwindow(STATS_MAXWINDOWSHIFT + 1));
+	CHECK(stats_getwindow() == STATS_MAXWINDOWSHIFT);
+	CHECK(stats_setwindow(STATS_WINDOWSHIFT));
+}
+
+static void test_feedforward(void) {
+	highgain = false;
+	feedforward_clear();
+	CHECK(feedforward_duty(1000) == LOAD_MAXDUTY);
+
+	// only settled readings are learned
+	feedforward_learn(1000, 500, 600);
+	CHECK(feedforward_duty(1000) == LOAD_MAXDUTY);
+
+	feedforward_learn(1000, 1000, 800);
+	feedforward_learn(3000, 3000, 400);
+	CHECK(feedforward_duty(1000) == 800);
+	CHECK(feedforward_duty(2000) == 600);
+	CHECK(feedforward_duty(3000) == 400);
+	CHECK(feedforward_duty(3500) == 400);
+	CHECK(feedforward_duty(500) > 800 && feedforward_duty(500) < LOAD_MAXDUTY);
+	feedforward_clear();
+}
+
+static void test_datalog(void) {
+	// writes finish straight away
+	FLASH_IAPSR = FLASH_IAPSR_DUL | FLASH_IAPSR_EOP;
+	datalog_setstorage(DATALOG_EEPROM);
+
+	// left by firmware from before the header had a format in it
+	EEPROM(EEPROM_LOG) = 5;
+	EEPROM(EEPROM_LOG + 1) = 0;
+	EEPROM(EEPROM_LOG + 2) = 0;
+	datalog_init();
+	CHECK(datalog_count() == 0);
+	CHECK(EEPROM(EEPROM_LOG) == 0);
+
+	// the format is there now so the count is kept
+	EEPROM(EEPROM_LOG) = 5;
+	datalog_init();
+	CHECK(datalog_count() == 5);
+
+	datalog_setstorage(DATALOG_RAM);
+}
+
+static void test_ticks(uint16_t ms) {
+	for (; ms > 0; ms--)
+		timer_interrupthandler();
+}
+
+#ifdef PERF
+// the timer isr runs with the overflow that started it still flagged
+static void test_timerperf(void) {
+	perf_stats stats;
+
+	perf_reset();
+	TIM3_CNTRH = 0;
+	TIM3_CNTRL = 40;
+	TIM3_SR1 = TIM3_SR1_UIF;
+	timer_interrupthandler();
+	CHECK(!(TIM3_SR1 & TIM3_SR1_UIF));
+	perf_get(PERF_TIMERISR, &stats);
+	CHECK(stats.calls == 1 && stats.max < TIMER_CYCLESPERMILLI);
+	TIM3_CNTRL = 0;
+}
+#endif
+
+static void test_energy(void) {
+	uint8_t i;
+
+	amps = 1000;
+	watts = 1000;
+	energy_reset();
+	// readings 50ms apart for 4s is 1.11mAh and mWh, none of it gets
+	// dropped for coming in slowly
+	for (i = 0; i < 80; i++) {
+		test_ticks(50);
+		energy_update();
+	}
+	CHECK(amphours == 1);
+	CHECK(watthours == 1);
+	amps = 0;
+	watts = 0;
+}
+
+// feeds line through the receive isr, the replies all go straight out to
+// the data register
+static void test_command(const char* line) {
+	UART2_SR = UART2_SR_TXE;
+	for (; *line != '\0'; line++) {
+		UART2_DR = *line;
+		uart_rxhandler();
+	}
+	protocol_checkcommand();
+}
+
+static void test_protocol(void) {
+	protocol_init();
+
+	test_command("STATS,10\n");
+	CHECK(stats_getwindow() == 10);
+	// 264 is 8 once it's a byte
+	test_command("STATS,264\n");
+	CHECK(stats_getwindow() == 10);
+	test_command("STATS,16\n");
+	CHECK(stats_getwindow() == 10);
+	stats_setwindow(STATS_WINDOWSHIFT);
+}
+
+// sends what's in the transmit fifo through the isr, counts the lines
+static uint8_t test_drain(void) {
+	uint8_t lines = 0;
+
+	UART2_SR = UART2_SR_TXE;
+	while (uart_txfree() != UART_FIFOSIZE - 1) {
+		uart_txhandler();
+		if (UART2_DR == '\n')
+			lines++;
+	}
+	return lines;
+}
+
+#ifdef PERF
+// the report goes out from checkpending as there's room, the data
+// register stays busy so it all has to go through the fifo
+static void test_perflisting(void) {
+	uint8_t lines = 0, passes;
+
+	test_command("PERF\n");
+	for (passes = 0; passes < 50 && lines < PERF_END; passes++) {
+		UART2_SR = 0;
+		protocol_checkpending();
+		lines += test_drain();
+	}
+	CHECK(lines == PERF_END);
+	CHECK(passes > 1);
+}
+#endif
+
+static uint8_t test_listinglines(const char* line) {
+	uint8_t lines = 0, passes;
+
+	test_command(line);
+	for (passes = 0; passes < 10; passes++) {
+		UART2_SR = 0;
+		protocol_checkpending();
+		lines += test_drain();
+	}
+	return lines;
+}
+
+static void test_listings(void) {
+	CHECK(test_listinglines("STATS\n") == 1);
+
+	highgain = false;
+	feedforward_clear();
+	CHECK(test_listinglines("FF\n") == 0);
+	feedforward_learn(1000, 1000, 800);
+	feedforward_learn(3000, 3000, 400);
+	CHECK(test_listinglines("FF\n") == 2);
+	feedforward_clear();
+
+	// nothing has run, just the status
+	CHECK(test_listinglines("SEQ\n") == 1);
+}
+
+// the transient high level gets the derate like a setpoint does
+static void test_derate(void) {
+	uint16_t i, derated;
+
+	highgain = false;
+	feedforward_clear();
+	feedforward_learn(1000, 1000, 800);
+	feedforward_learn(3000, 3000, 400);
+
+	// heats up to about 90C over ten minutes flat out
+	watts = 0xffff;
+	for (i = 0; i < 6000; i++) {
+		test_ticks(THERMAL_STEPMS);
+		thermal_update();
+	}
+	derated = thermal_derate(3000);
+	CHECK(derated > 1000 && derated < 2000);
+
+	CHECK(transient_setlevels(500, 3000));
+	transient_start();
+	// the high part of the period comes first
+	test_ticks(1);
+	CHECK(load_getduty() == feedforward_duty(derated));
+	CHECK(load_getduty() > 400);
+	transient_stop();
+
+	watts = 0;
+	feedforward_clear();
+}
+
+int main(void) {
+	test_bcd();
+	test_setpoint();
+	test_calibration();
+	test_protection();
+	test_stats();
+	test_feedforward();
+	test_datalog();
+	test_protocol();
+	test_energy();
+#ifdef PERF
+	test_timerperf();
+	test_perflisting();
+#endif
+	test_listings();
+	// leaves the model hot
+	test_derate();
+
+	if (failures != 0) {
+		printf("%d failed\n", failures);
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
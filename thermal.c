@@ -0,0 +1,107 @@
+#include "stm8.h"
+#include "thermal.h"
+#include "state.h"
+#include "timer.h"
+#include "util.h"
+
+#define FANPIN (1 << 2)
+
+// the rise over ambient with 16 fractional bits so the small steps
+// don't get lost
+static int32_t rise = 0;
+static uint16_t temperature = THERMAL_AMBIENT;
+static uint32_t laststep = 0;
+
+static uint16_t fanstart = THERMAL_FANSTART;
+static uint16_t fanfull = THERMAL_FANFULL;
+static volatile uint8_t fanduty = 0;
+static uint8_t fanphase = 0;
+
+// the fan takes out part of the difference between still air and fan
+// cooling in proportion to how long it's on for
+static uint16_t thermal_rth(void) {
+	return THERMAL_RTH
+			- ((THERMAL_RTH - THERMAL_RTHFAN) * fanduty) / THERMAL_FANPERIOD;
+}
+
+static void thermal_step(void) {
+	int32_t target = ((uint32_t) watts * thermal_rth()) >> THERMAL_RTHSHIFT;
+
+	rise += ((target << 16) - rise) >> THERMAL_TAUSHIFT;
+	temperature = THERMAL_AMBIENT + (uint16_t) (rise >> 16);
+}
+
+static void thermal_updatefan(void) {
+	uint8_t duty;
+
+	if (temperature >= fanfull)
+		duty = THERMAL_FANPERIOD;
+	else if (temperature >= fanstart)
+		duty = THERMAL_FANMIN
+				+ ((uint32_t) (THERMAL_FANPERIOD - THERMAL_FANMIN)
+						* (temperature - fanstart)) / (fanfull - fanstart);
+	else if (fanduty != 0 && temperature + THERMAL_FANHYSTERESIS >= fanstart)
+		duty = THERMAL_FANMIN;
+	else
+		duty = 0;
+
+	fanduty = duty;
+}
+
+// with every new set of readings, keeps running after the load goes off
+// so the fan stays on while the heatsink cools down
+void thermal_update(void) {
+	uint32_t now = timer_millis();
+
+	while (now - laststep >= THERMAL_STEPMS) {
+		laststep += THERMAL_STEPMS;
+		thermal_step();
+		thermal_updatefan();
+	}
+}
+
+// what the regulator should go for at the modelled temperature
+uint16_t thermal_derate(uint16_t target) {
+	uint16_t over;
+
+	if (temperature <= THERMAL_DERATESTART)
+		return target;
+
+	over = temperature - THERMAL_DERATESTART;
+	if (over >= (1 << THERMAL_DERATESHIFT))
+		return 0;
+	return ((uint32_t) target * ((1 << THERMAL_DERATESHIFT) - over))
+			>> THERMAL_DERATESHIFT;
+}
+
+bool thermal_setfancurve(uint16_t start, uint16_t full) {
+	if (start >= full || start < THERMAL_AMBIENT)
+		return false;
+	fanstart = start;
+	fanfull = full;
+	return true;
+}
+
+uint16_t thermal_temperature(void) {
+	return temperature;
+}
+
+// ms on in every THERMAL_FANPERIOD
+uint8_t thermal_fanduty(void) {
+	return fanduty;
+}
+
+void thermal_tick(void) {
+	if (fanphase < fanduty)
+		*PB_ODR |= FANPIN;
+	else
+		*PB_ODR &= ~FANPIN;
+
+	fanphase++;
+	if (fanphase == THERMAL_FANPERIOD)
+		fanphase = 0;
+}
+
+void thermal_init(void) {
+	setuppins(PB_DDR, PB_CR1, FANPIN);
+}
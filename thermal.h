@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// there's no temperature sensor so the heatsink is modelled, it heats up
+// towards ambient + watts * thermal resistance and gets there in a first
+// order way. temperatures are in hundredths of a degree
+
+#define THERMAL_AMBIENT 2500
+
+// hundredths of a degree per mW scaled by 2^THERMAL_RTHSHIFT, about
+// 2.5C/W still and 1C/W with the fan flat out
+#define THERMAL_RTHSHIFT 8
+#ifndef THERMAL_RTH
+#define THERMAL_RTH 64
+#endif
+#ifndef THERMAL_RTHFAN
+#define THERMAL_RTHFAN 26
+#endif
+
+// the model steps every THERMAL_STEPMS and closes 1/2^THERMAL_TAUSHIFT of
+// the gap each time, about 50s
+#define THERMAL_STEPMS 100
+#ifndef THERMAL_TAUSHIFT
+#define THERMAL_TAUSHIFT 9
+#endif
+
+// the fan comes on at the start temperature, goes linearly up to full at
+// the full one and goes off again THERMAL_FANHYSTERESIS below the start
+#define THERMAL_FANSTART 4000
+#define THERMAL_FANFULL 6000
+#define THERMAL_FANHYSTERESIS 300
+
+// software pwm on the fan pin from the 1ms tick, the fan won't spin up
+// with less than THERMAL_FANMIN ms on
+#define THERMAL_FANPERIOD 20
+#define THERMAL_FANMIN 8
+
+// the target current backs off linearly from THERMAL_DERATESTART and is
+// down to nothing 2^THERMAL_DERATESHIFT above it
+#define THERMAL_DERATESTART 8000
+#define THERMAL_DERATESHIFT 11
+
+void thermal_update(void);
+uint16_t thermal_derate(uint16_t target);
+bool thermal_setfancurve(uint16_t start, uint16_t full);
+uint16_t thermal_temperature(void);
+uint8_t thermal_fanduty(void);
+void thermal_init(void);
+
+// from the timer isr every ms
+void thermal_tick(void);
@@ -1,26 +1,118 @@
 #include "timer.h"
 #include "state.h"
+#include "events.h"
+#include "perf.h"
+#include "transient.h"
+#include "thermal.h"
+#include "uart.h"
+
+// never wraps in practice, 49 days
+static volatile uint32_t millis = 0;
+static uint16_t subsecond = 0;
+static bool running = false;
 
 void timer_interrupthandler(void)
 __interrupt(INTERRUPT_TIM3_UPDATEOVERFLOW) {
-	time++;
-	TIM3_SR1 &= ~TIM3_SR1_UIF;
+	// the entry stamp is taken with the overflow still pending so
+	// timer_getstamp counts the new ms for it, then the count and the flag
+	// change together so no stamp in between sees the ms twice
+	perf_enter(PERF_TIMERISR);
+	__critical {
+		millis++;
+		TIM3_SR1 &= ~TIM3_SR1_UIF;
+	}
+	transient_tick();
+	thermal_tick();
+	uart_tick();
+	events_post(EVENT_TICK);
+	if (running) {
+		subsecond++;
+		if (subsecond == 1000) {
+			subsecond = 0;
+			time++;
+		}
+	}
+	perf_exit(PERF_TIMERISR);
+}
+
+// safe to call from isrs
+uint32_t timer_millis(void) {
+	uint32_t now;
+	__critical {
+		now = millis;
+	}
+	return now;
+}
+
+// whole seconds since timer_start()
+uint32_t timer_runtime(void) {
+	uint32_t now;
+	__critical {
+		now = time;
+	}
+	return now;
+}
+
+static inline uint16_t timer_readcounter(void) {
+	// the low byte is latched when the high byte is read
+	uint16_t count = ((uint16_t) TIM3_CNTRH) << 8;
+	return count | TIM3_CNTRL;
+}
+
+// safe to call from isrs
+void timer_getstamp(timer_stamp* stamp) {
+	__critical {
+		stamp->millis = (uint16_t) millis;
+		stamp->count = timer_readcounter();
+		// the counter overflowed but the interrupt hasn't been serviced yet
+		if (TIM3_SR1 & TIM3_SR1_UIF) {
+			stamp->millis++;
+			stamp->count = timer_readcounter();
+		}
+	}
+}
+
+// start has to be less than 65.536s before end
+uint32_t timer_cyclesbetween(timer_stamp* start, timer_stamp* end) {
+	uint32_t cycles = (int32_t) end->count - start->count;
+	if (end->millis != start->millis)
+		cycles += (uint32_t) (uint16_t) (end->millis - start->millis)
+				* TIMER_CYCLESPERMILLI;
+	return cycles;
+}
+
+uint32_t timer_cyclessince(timer_stamp* start) {
+	timer_stamp now;
+	timer_getstamp(&now);
+	return timer_cyclesbetween(start, &now);
+}
+
+// wraps every 65.536ms
+uint16_t timer_micros(void) {
+	timer_stamp now;
+	timer_getstamp(&now);
+	return (now.millis * 1000) + (now.count >> 4);
 }
 
 void timer_start() {
+	disableInterrupts();
 	time = 0;
-	TIM3_CNTRH = 0;
-	TIM3_CCR1L = 0;
-	TIM3_CR1 |= TIM3_CR1_CEN;
+	subsecond = 0;
+	running = true;
+	enableInterrupts();
 }
 
 void timer_stop() {
-	TIM3_CR1 &= ~TIM3_CR1_CEN;
+	running = false;
 }
 
+// 1ms ticks from the 16MHz clock, counts the run time while started
 void timer_init() {
-	TIM3_ARRH = 0x01;
-	TIM3_ARRL = 0xe8;
-	TIM3_PSCR = 0x0f;
+	const uint16_t reloadvalue = TIMER_CYCLESPERMILLI - 1;
+
+	TIM3_ARRH = (uint8_t)((reloadvalue >> 8) & 0xff);
+	TIM3_ARRL = (uint8_t)(reloadvalue & 0xff);
+	TIM3_PSCR = 0;
 	TIM3_IER |= TIM3_IER_UIE;
+	TIM3_CR1 |= TIM3_CR1_CEN;
 }
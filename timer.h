@@ -5,6 +5,22 @@
 void timer_interrupthandler(void)
 __interrupt(INTERRUPT_TIM3_UPDATEOVERFLOW);
 
+#define TIMER_CYCLESPERMILLI 16000
+
+// position of the free running 16MHz count, only the low bits of the ms
+// so it's for measuring short things
+typedef struct {
+	uint16_t millis;
+	uint16_t count;
+} timer_stamp;
+
+uint32_t timer_millis(void);
+uint32_t timer_runtime(void);
+void timer_getstamp(timer_stamp* stamp);
+uint32_t timer_cyclesbetween(timer_stamp* start, timer_stamp* end);
+uint32_t timer_cyclessince(timer_stamp* start);
+uint16_t timer_micros(void);
+
 void timer_start(void);
 
 void timer_stop(void);
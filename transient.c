@@ -0,0 +1,132 @@
+#include "stm8.h"
+#include "transient.h"
+#include "state.h"
+#include "load.h"
+#include "feedforward.h"
+#include "thermal.h"
+
+// in mA and ms, both levels are derated with the temperature the same as a
+// constant current setpoint
+static uint16_t levels[2] = { 500, 3000 };
+static uint16_t period = 10;
+static uint16_t hightime = 5;
+
+// the duty that gives each level, learned while running and kept until
+// the levels change. LOAD_MAXDUTY is one that hasn't been trimmed yet and
+// starts from the feedforward map
+static uint16_t duties[2] = { LOAD_MAXDUTY, LOAD_MAXDUTY };
+
+static volatile bool active = false;
+static volatile uint8_t level = 0;
+static volatile uint16_t sinceedge = 0;
+static uint16_t phase = 0;
+
+bool transient_setlevels(uint16_t low, uint16_t high) {
+	if (low >= high)
+		return false;
+
+	disableInterrupts();
+	levels[0] = low;
+	levels[1] = high;
+	duties[0] = LOAD_MAXDUTY;
+	duties[1] = LOAD_MAXDUTY;
+	enableInterrupts();
+	return true;
+}
+
+bool transient_settiming(uint16_t newperiod, uint16_t newhightime) {
+	if (newhightime == 0 || newhightime >= newperiod)
+		return false;
+
+	disableInterrupts();
+	period = newperiod;
+	hightime = newhightime;
+	phase = 0;
+	enableInterrupts();
+	return true;
+}
+
+// the high part of the period comes first
+void transient_tick(void) {
+	uint8_t newlevel;
+
+	if (!active)
+		return;
+
+	newlevel = phase < hightime;
+	if (newlevel != level) {
+		level = newlevel;
+		sinceedge = 0;
+		load_setduty(duties[newlevel]);
+	} else if (sinceedge != 0xffff)
+		sinceedge++;
+
+	phase++;
+	if (phase == period)
+		phase = 0;
+}
+
+void transient_start(void) {
+	uint8_t i;
+
+	for (i = 0; i < 2; i++) {
+		if (duties[i] == LOAD_MAXDUTY)
+			duties[i] = feedforward_duty(thermal_derate(levels[i]));
+	}
+
+	disableInterrupts();
+	phase = 0;
+	level = 0;
+	sinceedge = 0;
+	load_setduty(duties[0]);
+	active = true;
+	enableInterrupts();
+}
+
+void transient_stop(void) {
+	active = false;
+}
+
+// trims the duty for whichever level is on with the last reading, the isr
+// picks the new duty up at the next edge if it's moved on already
+void transient_update(void) {
+	uint8_t current;
+	uint16_t since, target;
+	int32_t error;
+	int16_t step, duty;
+
+	disableInterrupts();
+	current = level;
+	since = sinceedge;
+	enableInterrupts();
+
+	if (since < TRANSIENT_SETTLEMS)
+		return;
+
+	// more current needs more drive which is less duty
+	target = thermal_derate(levels[current]);
+	error = (int32_t) target - amps;
+	error >>= TRANSIENT_TRIMSHIFT;
+	if (error > TRANSIENT_TRIMMAX)
+		step = TRANSIENT_TRIMMAX;
+	else if (error < -TRANSIENT_TRIMMAX)
+		step = -TRANSIENT_TRIMMAX;
+	else if (error == 0 && target != amps)
+		step = target > amps ? 1 : -1;
+	else
+		step = error;
+
+	duty = (int16_t) duties[current] - step;
+	if (duty < LOAD_MINDUTY)
+		duty = LOAD_MINDUTY;
+	else if (duty > LOAD_MAXDUTY)
+		duty = LOAD_MAXDUTY;
+
+	disableInterrupts();
+	duties[current] = duty;
+	if (level == current)
+		load_setduty(duty);
+	enableInterrupts();
+
+	feedforward_learn(target, amps, duty);
+}
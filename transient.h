@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// readings this soon after an edge can still have some of the last level
+// averaged into them so they're left out of the trim
+#ifndef TRANSIENT_SETTLEMS
+#define TRANSIENT_SETTLEMS 2
+#endif
+
+// the trim moves the duty by error / 2^TRANSIENT_TRIMSHIFT, at most
+// TRANSIENT_TRIMMAX counts per reading
+#define TRANSIENT_TRIMSHIFT 5
+#define TRANSIENT_TRIMMAX 32
+
+bool transient_setlevels(uint16_t low, uint16_t high);
+bool transient_settiming(uint16_t period, uint16_t high);
+void transient_start(void);
+void transient_stop(void);
+void transient_update(void);
+
+// from the timer isr every ms
+void transient_tick(void);
@@ -2,35 +2,51 @@
 
 #include "stm8.h"
 #include "uart.h"
-#include "state.h"
+#include "events.h"
+#include "perf.h"
 
-#define FIFOSIZE 64
-
-static char txbuffer[FIFOSIZE];
+static char txbuffer[UART_FIFOSIZE];
 static uint8_t txhead = 0;
-static uint8_t txtail = 0;
-static char rxbuffer[FIFOSIZE];
+// moved on by the isr
+static volatile uint8_t txtail = 0;
+static char rxbuffer[UART_FIFOSIZE];
 static uint8_t rxhead = 0;
 static uint8_t rxtail = 0;
 static bool rxoverflow = false;
 
+// on a shared bus the transmitter is only turned on to send a reply, once
+// the line has been quiet for UART_TURNAROUNDMS, and off again as soon as
+// the last byte is out so the pin floats for the other units
+static bool bus = false;
+static volatile uint8_t quietms = 0;
+// a byte is being sent or is waiting in the data register
+static volatile bool sending = false;
+
 void uart_txhandler(void)
 __interrupt(INTERRUPT_UART2_TXCOMPLETE) {
+	perf_enter(PERF_UARTTXISR);
 	UART2_SR &= ~UART2_SR_TC;
-	if(txtail != txhead) {
+	if (!(UART2_SR & UART2_SR_TXE)) {
+		// still busy with the byte after an idle frame
+	} else if(txtail != txhead) {
 		UART2_DR = txbuffer[txtail];
-		txtail = (txtail + 1) % FIFOSIZE;
+		txtail = (txtail + 1) % UART_FIFOSIZE;
+	} else {
+		sending = false;
+		if (bus)
+			UART2_CR2 &= ~UART2_CR2_TEN;
 	}
+	perf_exit(PERF_UARTTXISR);
 }
 
 static inline void uart_rxhandler_body(void) {
 	uint8_t byte = UART2_DR;
+	quietms = 0;
 	if (!rxoverflow) {
-		if (((rxhead + 1) % FIFOSIZE) != rxtail) {
-			if (byte == '\n')
-				sequence++;
+		if (((rxhead + 1) % UART_FIFOSIZE) != rxtail) {
 			rxbuffer[rxhead] = byte;
-			rxhead = (rxhead + 1) % FIFOSIZE;
+			rxhead = (rxhead + 1) % UART_FIFOSIZE;
+			events_post(EVENT_UARTRX);
 		} else
 			rxoverflow = true;
 	}
@@ -38,20 +54,39 @@ static inline void uart_rxhandler_body(void) {
 
 void uart_rxhandler(void)
 __interrupt( INTERRUPT_UART2_RXFULL) {
+	perf_enter(PERF_UARTRXISR);
 	uart_rxhandler_body();
+	perf_exit(PERF_UARTRXISR);
 }
 
 void uart_putch(char ch) {
-	if (txtail == txhead && (UART2_SR & UART2_SR_TXE) != 0) {
+	if (!bus && txtail == txhead && (UART2_SR & UART2_SR_TXE) != 0) {
+		sending = true;
 		UART2_DR = ch;
 	} else {
-		while (((txtail + 1) % FIFOSIZE) == txhead) {
+		// only ever waits with the fifo full
+		while (((txhead + 1) % UART_FIFOSIZE) == txtail) {
 		}
 		txbuffer[txhead] = ch;
-		txhead = (txhead + 1) % FIFOSIZE;
+		txhead = (txhead + 1) % UART_FIFOSIZE;
 	}
 }
 
+uint8_t uart_txfree(void) {
+	return (uint8_t) ((txtail - txhead - 1 + UART_FIFOSIZE) % UART_FIFOSIZE);
+}
+
+// queues the whole buffer or nothing at all, never blocks
+bool uart_write(char* buffer, uint8_t len) {
+	if (uart_txfree() < len)
+		return false;
+
+	// nothing but us adds to the fifo so it can only have more room now
+	while (len-- > 0)
+		uart_putch(*buffer++);
+	return true;
+}
+
 void uart_puts(char* str) {
 	while (*str != '\0')
 		uart_putch(*str++);
@@ -60,9 +95,48 @@ void uart_puts(char* str) {
 bool uart_getch(uint8_t* result) {
 	if (rxtail != rxhead) {
 		*result = rxbuffer[rxtail];
-		rxtail = (rxtail + 1) % FIFOSIZE;
-	} else
+		rxtail = (rxtail + 1) % UART_FIFOSIZE;
+		return true;
+	} else {
+		// everything that was received has been read, start over
+		rxoverflow = false;
 		return false;
+	}
+}
+
+// starts sending what's queued once the line has been quiet long enough,
+// the first byte goes out after the idle frame turning the transmitter on
+// sends
+void uart_tick(void) {
+	if (quietms < UART_TURNAROUNDMS)
+		quietms++;
+
+	if (!bus || sending || txtail == txhead || quietms < UART_TURNAROUNDMS)
+		return;
+
+	sending = true;
+	UART2_CR2 |= UART2_CR2_TEN;
+	UART2_DR = txbuffer[txtail];
+	txtail = (txtail + 1) % UART_FIFOSIZE;
+}
+
+// if something is being sent the transmitter goes off once it's out
+void uart_setbus(bool on) {
+	__critical {
+		bus = on;
+		if (on) {
+			if (!sending)
+				UART2_CR2 &= ~UART2_CR2_TEN;
+		} else {
+			UART2_CR2 |= UART2_CR2_TEN;
+			// anything held back for the turnaround goes now
+			if (!sending && txtail != txhead) {
+				sending = true;
+				UART2_DR = txbuffer[txtail];
+				txtail = (txtail + 1) % UART_FIFOSIZE;
+			}
+		}
+	}
 }
 
 void uart_configure() {
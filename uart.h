@@ -4,11 +4,24 @@
 
 #include "stm8.h"
 
+// ms of quiet after the last byte received before a reply goes out on a
+// shared bus
+#define UART_TURNAROUNDMS 2
+
+// has to hold a whole state line
+#define UART_FIFOSIZE 128
+
 void uart_configure(void);
+void uart_setbus(bool on);
 void uart_putch(char ch);
 void uart_puts(char* str);
+uint8_t uart_txfree(void);
+bool uart_write(char* buffer, uint8_t len);
 bool uart_getch(uint8_t* result);
 
+// from the timer isr every ms
+void uart_tick(void);
+
 void uart_txhandler(void)
 __interrupt( INTERRUPT_UART2_TXCOMPLETE);
 void uart_rxhandler(void)
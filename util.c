@@ -1,29 +1,18 @@
 #include "util.h"
 
-void split(uint16_t value, uint16_t* buffer, int digits) {
-	uint16_t tmp;
-	for (; digits > 0; digits--) {
-		tmp = value % 10;
-		buffer[digits - 1] = tmp;
-		value -= tmp;
-		if (value == 0) {
-			digits--;
-			break;
-		} else
-			value /= 10;
+// crc-8, polynomial 0x07
+uint8_t crc8(uint8_t crc, uint8_t* buffer, uint8_t len) {
+	uint8_t i;
+	for (; len > 0; len--) {
+		crc ^= *buffer++;
+		for (i = 0; i < 8; i++) {
+			if (crc & 0x80)
+				crc = (crc << 1) ^ 0x07;
+			else
+				crc <<= 1;
+		}
 	}
-	for (; digits > 0; digits--)
-		buffer[digits - 1] = 0;
-}
-
-uint16_t pack(uint16_t* buffer, int digits) {
-	uint16_t tmp = 0;
-	int i;
-	for (i = 0; i < digits; i++) {
-		tmp *= 10;
-		tmp += buffer[i];
-	}
-	return tmp;
+	return crc;
 }
 
 void setuppins(volatile uint8_t* ddr, volatile uint8_t* cr1, uint8_t bits) {